@@ -10,10 +10,24 @@
 layout(location = 0) in vec2 inPos;
 layout(location = 1) in vec3 inCol;
 
+// per instance, see Instance in scene.hpp
+layout(location = 2) in vec4 inTransform; // offset, scale
+layout(location = 3) in vec3 inInstance; // rotation (cos, sin), tint
+
 layout (location = 0) out vec3 outColor;
 
+// whether the vertex colors are final, i.e. already blended and
+// tinted (baked meshes, see writeMesh)
+layout(constant_id = 0) const bool bakedColors = false;
+
+// constant part of the color blend, folded at compile time
+const vec3 baseColor = 0.4 * vec3(0.7, 0.5, 0.0);
+
 void main()
 {
-	outColor = 0.45 * inCol + 0.4 * vec3(0.7, 0.5, 0.0);
-	gl_Position = vec4(inPos, 0.0, 1.0);
+	outColor = bakedColors ? inCol : inInstance.z * (0.45 * inCol + baseColor);
+
+	vec2 pos = inTransform.zw * inPos;
+	pos = mat2(inInstance.x, inInstance.y, -inInstance.y, inInstance.x) * pos;
+	gl_Position = vec4(inTransform.xy + pos, 0.0, 1.0);
 }
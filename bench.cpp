@@ -0,0 +1,435 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+// Headless msaa benchmark.
+// Sweeps sample counts x resolve modes x resolutions x scene complexity and
+// writes frame time distributions and memory usage as csv and/or json.
+// Optionally also sweeps vertex formats to compare the vertex fetch bandwidth.
+
+#include <engine.hpp>
+#include <render.hpp>
+#include <stats.hpp>
+#include <raster.hpp>
+
+#include <dlg/dlg.hpp> // dlg
+
+#include <algorithm> // std::find
+#include <chrono>
+#include <condition_variable>
+#include <cstdio> // std::sscanf
+#include <cstdlib> // std::strtoul, std::strtof
+#include <cstring> // std::strcmp
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::high_resolution_clock;
+using msf = std::chrono::duration<float, std::milli>;
+
+struct BenchConfig {
+	std::vector<unsigned int> samples {1, 2, 4, 8};
+	std::vector<ResolveMode> resolves {ResolveMode::renderPass, ResolveMode::box,
+		ResolveMode::tent, ResolveMode::tonemap, ResolveMode::fxaa};
+	std::vector<nytl::Vec2ui> sizes {{640, 480}, {1920, 1080}, {3840, 2160}};
+	std::vector<unsigned int> triangles {1, 1000, 100000};
+	float overlap = 0.f;
+	float edgeDensity = 1.f;
+	std::string mesh; // replaces the generated scenes
+	std::vector<VertexFormat> vertexFormats; // empty for the scene default
+	unsigned int warmup = 20;
+	unsigned int frames = 200;
+	// maximum channel difference to the cpu reference, -1 to not compare
+	int reference = -1;
+	std::string csv;
+	std::string json;
+};
+
+struct BenchResult {
+	unsigned int samples;
+	ResolveMode resolve;
+	nytl::Vec2ui size;
+	unsigned int triangles;
+	VertexFormat vertexFormat;
+	float fps;
+	FrameStats stats;
+	vk::DeviceSize memory; // total
+	vk::DeviceSize multisampleMemory; // or post-process target for fxaa
+	vk::DeviceSize vertexMemory; // vertex buffer
+	vk::DeviceSize vertexFetch; // vertex bytes read per frame
+	float mismatch; // pixels differing from the cpu reference, -1 if not compared
+};
+
+// Parses a comma separated list of values with the given parser.
+template<typename T, typename F>
+std::vector<T> parseList(const char* str, F&& parse)
+{
+	std::vector<T> ret;
+	std::string s = str;
+	std::size_t pos = 0;
+	while(pos <= s.size()) {
+		auto end = s.find(',', pos);
+		if(end == std::string::npos) {
+			end = s.size();
+		}
+
+		ret.push_back(parse(s.substr(pos, end - pos)));
+		pos = end + 1;
+	}
+
+	return ret;
+}
+
+bool parseArgs(int argc, char** argv, BenchConfig& config)
+{
+	auto toUint = [](const std::string& str) {
+		return unsigned(std::strtoul(str.c_str(), nullptr, 10));
+	};
+
+	auto toResolve = [](const std::string& str) {
+		auto mode = ResolveMode::renderPass;
+		if(!parseResolveMode(str.c_str(), mode)) {
+			dlg_warn("Invalid resolve mode '{}', using renderpass", str);
+		}
+		return mode;
+	};
+
+	auto toFormat = [](const std::string& str) {
+		auto format = VertexFormat::float32;
+		if(!parseVertexFormat(str.c_str(), format)) {
+			dlg_warn("Invalid vertex format '{}', using float32", str);
+		}
+		return format;
+	};
+
+	auto toSize = [](const std::string& str) {
+		nytl::Vec2ui size {};
+		std::sscanf(str.c_str(), "%ux%u", &size.x, &size.y);
+		return size;
+	};
+
+	for(auto i = 1; i < argc; ++i) {
+		auto arg = argv[i];
+		if(i + 1 >= argc) {
+			dlg_error("Missing value for '{}'", arg);
+			return false;
+		}
+
+		auto value = argv[++i];
+		if(!std::strcmp(arg, "--samples")) {
+			config.samples = parseList<unsigned int>(value, toUint);
+		} else if(!std::strcmp(arg, "--resolves")) {
+			config.resolves = parseList<ResolveMode>(value, toResolve);
+		} else if(!std::strcmp(arg, "--sizes")) {
+			config.sizes = parseList<nytl::Vec2ui>(value, toSize);
+		} else if(!std::strcmp(arg, "--triangles")) {
+			config.triangles = parseList<unsigned int>(value, toUint);
+		} else if(!std::strcmp(arg, "--overlap")) {
+			config.overlap = std::strtof(value, nullptr);
+		} else if(!std::strcmp(arg, "--edge-density")) {
+			config.edgeDensity = std::strtof(value, nullptr);
+		} else if(!std::strcmp(arg, "--mesh")) {
+			config.mesh = value;
+		} else if(!std::strcmp(arg, "--vertex-formats")) {
+			config.vertexFormats = parseList<VertexFormat>(value, toFormat);
+		} else if(!std::strcmp(arg, "--warmup")) {
+			config.warmup = toUint(value);
+		} else if(!std::strcmp(arg, "--frames")) {
+			config.frames = toUint(value);
+		} else if(!std::strcmp(arg, "--reference")) {
+			config.reference = toUint(value);
+		} else if(!std::strcmp(arg, "--csv")) {
+			config.csv = value;
+		} else if(!std::strcmp(arg, "--json")) {
+			config.json = value;
+		} else {
+			dlg_error("Invalid argument '{}'", arg);
+			return false;
+		}
+	}
+
+	// the triangle counts are only used for generated scenes
+	if(!config.mesh.empty()) {
+		config.triangles = {0u};
+	} else if(std::find(config.triangles.begin(), config.triangles.end(), 0u) !=
+			config.triangles.end()) {
+		dlg_error("Triangle counts must be at least 1");
+		return false;
+	}
+
+	return true;
+}
+
+// Renders the scene on the cpu and returns the fraction of pixels of
+// the given frame that differ by more than tolerance in any channel.
+float compare(const SceneSettings& scene, vk::SampleCountBits samples,
+	nytl::Vec2ui size, const std::vector<std::uint32_t>& frame, int tolerance)
+{
+	CpuRasterizer raster({size.x, size.y}, samples);
+	raster.render(triangleVertices, triangleVertexCount,
+		generateInstances(scene));
+
+	auto& ref = raster.image();
+	if(frame.size() != ref.size()) {
+		return 1.f;
+	}
+
+	auto mismatches = 0u;
+	for(auto i = 0u; i < ref.size(); ++i) {
+		for(auto c = 0u; c < 32; c += 8) {
+			auto a = int((frame[i] >> c) & 0xFFu);
+			auto b = int((ref[i] >> c) & 0xFFu);
+			if(std::abs(a - b) > tolerance) {
+				++mismatches;
+				break;
+			}
+		}
+	}
+
+	return float(mismatches) / ref.size();
+}
+
+// Returns an empty optional if the sample count or resolve mode
+// is not supported.
+std::optional<BenchResult> run(const BenchConfig& config, unsigned int samples,
+	ResolveMode resolve, nytl::Vec2ui size, unsigned int triangles,
+	std::optional<VertexFormat> format)
+{
+	EngineSettings settings;
+	settings.headless = true;
+	settings.validation = false;
+	settings.prewarmPipelines = false;
+	settings.size = size;
+	settings.scene.count = triangles;
+	settings.scene.overlap = config.overlap;
+	settings.scene.edgeDensity = config.edgeDensity;
+	settings.scene.mesh = config.mesh;
+	settings.scene.vertexFormat = format;
+
+	// keep the last frame to compare it against the cpu reference.
+	// Only the box resolves with full precision vertices should match it
+	std::mutex frameMutex;
+	std::condition_variable frameCV;
+	std::vector<std::uint32_t> lastFrame;
+	std::uint64_t lastNumber {};
+	auto box = resolve == ResolveMode::renderPass || resolve == ResolveMode::box;
+	auto exact = vertexFormat(settings.scene) == VertexFormat::float32;
+	if(config.reference >= 0 && box && exact && config.mesh.empty()) {
+		settings.readback = [&](const ReadbackFrame& frame) {
+			std::lock_guard<std::mutex> lock(frameMutex);
+			lastFrame.resize(frame.size / 4);
+			std::memcpy(lastFrame.data(), frame.data, frame.size);
+			lastNumber = frame.number;
+			frameCV.notify_one();
+		};
+	}
+
+	// start with one sample and switch when we know the sample
+	// count is supported
+	Engine engine(settings);
+	auto& renderer = engine.renderer();
+	auto& limits = engine.vulkanDevice().properties().limits;
+	auto sampleBits = static_cast<vk::SampleCountBits>(samples);
+	if(!(limits.framebufferColorSampleCounts & sampleBits)) {
+		return {};
+	}
+
+	if(compute(resolve) && (!renderer.computeResolveSupported() ||
+			!(limits.sampledImageColorSampleCounts & sampleBits))) {
+		return {};
+	}
+
+	renderer.resolve(resolve);
+	renderer.samples(sampleBits);
+	while(renderer.samples() != sampleBits || renderer.resolve() != resolve ||
+			renderer.scene().streaming()) {
+		renderer.render();
+	}
+
+	for(auto i = 0u; i < config.warmup; ++i) {
+		renderer.render();
+	}
+
+	renderer.wait();
+	renderer.resetFrameStats();
+
+	auto start = Clock::now();
+	for(auto i = 0u; i < config.frames; ++i) {
+		renderer.render();
+	}
+
+	renderer.wait();
+	auto duration = msf(Clock::now() - start).count();
+
+	BenchResult result {};
+	result.mismatch = -1.f;
+	if(settings.readback) {
+		std::unique_lock<std::mutex> lock(frameMutex);
+		frameCV.wait(lock, [&]{
+			return lastNumber + 1 == renderer.submittedFrames(); });
+		result.mismatch = compare(settings.scene, sampleBits, size, lastFrame,
+			config.reference);
+	}
+
+	result.samples = samples;
+	result.resolve = resolve;
+	result.size = size;
+	result.triangles = triangles;
+	if(!config.mesh.empty()) {
+		result.triangles = renderer.scene().vertexCount() / 3;
+	}
+
+	// every instance fetches all vertices
+	auto& scene = renderer.scene();
+	result.vertexFormat = scene.vertexFormat();
+	result.vertexFetch = scene.vertexCount() * scene.count() *
+		vertexSize(scene.vertexFormat());
+
+	result.fps = 1000.f * config.frames / duration;
+	result.stats = renderer.frameStats();
+
+	auto report = renderer.memoryReport();
+	result.memory = report.total;
+	for(auto& entry : report.entries) {
+		if(entry.name == "multisample target" ||
+				entry.name == "post-process target") {
+			result.multisampleMemory = entry.committed;
+		} else if(entry.name == "vertex buffer") {
+			result.vertexMemory = entry.committed;
+		}
+	}
+
+	return result;
+}
+
+void writeCsv(const std::string& file, const std::vector<BenchResult>& results)
+{
+	std::ofstream out(file);
+	out << "samples,resolve_mode,width,height,triangles,vertex_format,fps,"
+		"cpu_min,cpu_avg,cpu_p50,cpu_p99,gpu_min,gpu_avg,gpu_p50,gpu_p99,"
+		"resolve_min,resolve_avg,resolve_p50,resolve_p99,"
+		"memory,multisample_memory,vertex_memory,vertex_fetch,"
+		"reference_mismatch\n";
+
+	auto summary = [&](const StatsSummary& s) {
+		out << s.min << "," << s.avg << "," << s.p50 << "," << s.p99 << ",";
+	};
+
+	for(auto& r : results) {
+		out << r.samples << "," << name(r.resolve) << "," << r.size.x << "," << r.size.y << ","
+			<< r.triangles << "," << name(r.vertexFormat) << "," << r.fps << ",";
+		summary(r.stats.cpu);
+		summary(r.stats.gpu);
+		summary(r.stats.resolve);
+		out << r.memory << "," << r.multisampleMemory << "," << r.vertexMemory << ","
+			<< r.vertexFetch << "," << r.mismatch << "\n";
+	}
+}
+
+void writeJson(const std::string& file, const std::vector<BenchResult>& results)
+{
+	std::ofstream out(file);
+	auto summary = [&](const char* name, const StatsSummary& s) {
+		out << "\"" << name << "\": {\"min\": " << s.min << ", \"avg\": "
+			<< s.avg << ", \"p50\": " << s.p50 << ", \"p99\": " << s.p99 << "}";
+	};
+
+	out << "[\n";
+	for(auto i = 0u; i < results.size(); ++i) {
+		auto& r = results[i];
+		out << "\t{\"samples\": " << r.samples
+			<< ", \"resolve_mode\": \"" << name(r.resolve) << "\""
+			<< ", \"width\": " << r.size.x
+			<< ", \"height\": " << r.size.y
+			<< ", \"triangles\": " << r.triangles
+			<< ", \"vertex_format\": \"" << name(r.vertexFormat) << "\""
+			<< ", \"fps\": " << r.fps << ", ";
+		summary("cpu", r.stats.cpu);
+		out << ", ";
+		summary("gpu", r.stats.gpu);
+		out << ", ";
+		summary("resolve", r.stats.resolve);
+		out << ", \"memory\": " << r.memory
+			<< ", \"multisample_memory\": " << r.multisampleMemory
+			<< ", \"vertex_memory\": " << r.vertexMemory
+			<< ", \"vertex_fetch\": " << r.vertexFetch
+			<< ", \"reference_mismatch\": " << r.mismatch << "}";
+		out << (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "]\n";
+}
+
+int main(int argc, char** argv)
+{
+	BenchConfig config;
+	if(!parseArgs(argc, argv, config)) {
+		dlg_info("usage: msaa-bench [--samples 1,2,4,8] "
+			"[--resolves renderpass,box,tent,tonemap,fxaa] "
+			"[--sizes 640x480,1920x1080] "
+			"[--triangles 1,1000] [--overlap <f>] [--edge-density <f>] "
+			"[--mesh <file>] [--vertex-formats float32,half,packed] "
+			"[--warmup <n>] [--frames <n>] [--reference <tolerance>] "
+			"[--csv <file>] [--json <file>]");
+		return EXIT_FAILURE;
+	}
+
+	// an empty format means the default of the scene
+	std::vector<std::optional<VertexFormat>> formats;
+	formats.assign(config.vertexFormats.begin(), config.vertexFormats.end());
+	if(formats.empty()) {
+		formats.emplace_back();
+	}
+
+	std::vector<BenchResult> results;
+	for(auto samples : config.samples) {
+		for(auto resolve : config.resolves) {
+			// without multisampling there is nothing to resolve,
+			// fxaa is only used without multisampling
+			auto fxaa = resolve == ResolveMode::fxaa;
+			if((samples == 1 && compute(resolve) && !fxaa) ||
+					(samples != 1 && fxaa)) {
+				continue;
+			}
+
+			for(auto size : config.sizes) {
+				for(auto triangles : config.triangles) {
+					for(auto format : formats) {
+						auto res = run(config, samples, resolve, size, triangles, format);
+						if(!res) {
+							dlg_warn("{} samples with {} resolve not supported, skipping",
+								samples, name(resolve));
+							continue;
+						}
+
+						// bytes fetched per gpu frame time, ignoring the caches
+						auto& r = *res;
+						auto bandwidth = r.stats.gpu.avg > 0.f ?
+							r.vertexFetch / (r.stats.gpu.avg * 1000.f * 1000.f) : 0.f;
+						dlg_info("{}x msaa, {} resolve, {}x{}, {} triangles, {} vertices: "
+							"{} fps, gpu {} avg {} p99, resolve {} avg (ms), "
+							"vertex fetch {} GB/s",
+							samples, name(resolve), size.x, size.y, r.triangles,
+							name(r.vertexFormat), r.fps, r.stats.gpu.avg,
+							r.stats.gpu.p99, r.stats.resolve.avg, bandwidth);
+						if(r.mismatch > 0.f) {
+							dlg_warn("{}% of the pixels differ from the cpu reference",
+								100 * r.mismatch);
+						}
+
+						results.push_back(r);
+					}
+				}
+			}
+		}
+	}
+
+	if(!config.csv.empty()) {
+		writeCsv(config.csv, results);
+	}
+
+	if(!config.json.empty()) {
+		writeJson(config.json, results);
+	}
+}
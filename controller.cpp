@@ -0,0 +1,150 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <controller.hpp>
+#include <render.hpp>
+#include <dlg/dlg.hpp> // dlg
+#include <algorithm> // std::min, std::max
+
+SampleController::SampleController(Renderer& renderer,
+	const SampleControllerSettings& settings) : renderer_(renderer),
+		settings_(settings), times_(settings.window)
+{
+	const vk::SampleCountBits counts[] = {
+		vk::SampleCountBits::e1,
+		vk::SampleCountBits::e2,
+		vk::SampleCountBits::e4,
+		vk::SampleCountBits::e8,
+	};
+
+	auto supported = renderer.device().properties().limits.framebufferColorSampleCounts;
+	for(auto count : counts) {
+		if(supported & count) {
+			levels_.push_back(count);
+		}
+
+		if(count == renderer.samples()) {
+			level_ = levels_.size() - 1;
+		}
+	}
+
+	holdBase_ = settings_.holdWindows;
+	dlg_info("SampleController: budget {} ms, starting at {} samples",
+		settings_.budget, (int) levels_[level_]);
+}
+
+void SampleController::update()
+{
+	// the sample count was switched manually (e.g. with the keyboard)
+	auto pending = renderer_.pendingSamples();
+	if(pending != levels_[level_]) {
+		resync(pending);
+	}
+
+	// frames rendered before a switch has been applied don't tell us
+	// anything about the new sample count
+	if(renderer_.samples() != levels_[level_]) {
+		firstFrame_ = renderer_.submittedFrames();
+		times_.reset();
+		return;
+	}
+
+	if(renderer_.timestamps()) {
+		auto completed = renderer_.completedFrames();
+		if(completed > lastCompleted_ && completed > firstFrame_) {
+			times_.add(renderer_.lastGpuTime());
+		}
+
+		lastCompleted_ = completed;
+	} else {
+		using msf = std::chrono::duration<float, std::milli>;
+		auto now = Clock::now();
+		if(lastUpdate_ != Clock::time_point {}) {
+			times_.add(msf(now - lastUpdate_).count());
+		}
+
+		lastUpdate_ = now;
+	}
+
+	if(times_.count() >= settings_.window) {
+		auto summary = times_.summary();
+		times_.reset();
+		decide(summary.p90);
+	}
+}
+
+void SampleController::decide(float p90)
+{
+	// windows without change after which a raise that had to be undone
+	// is no longer considered an oscillation
+	constexpr auto stableWindows = 8u;
+	constexpr auto maxHold = 64u;
+
+	++stable_;
+	if(hold_ > 0) {
+		--hold_;
+	}
+
+	if(stable_ >= stableWindows) {
+		holdBase_ = settings_.holdWindows;
+	}
+
+	auto budget = settings_.budget;
+	if(p90 > budget && level_ > 0) {
+		if(raised_ && stable_ < stableWindows) {
+			holdBase_ = std::min(2 * std::max(holdBase_, 1u), maxHold);
+		}
+
+		hold_ = holdBase_;
+		raised_ = false;
+		change(level_ - 1, p90);
+	} else if(p90 < budget * settings_.raiseThreshold &&
+			level_ + 1 < levels_.size()) {
+		if(hold_ > 0) {
+			dlg_info("SampleController: p90 {} ms, budget {} ms: "
+				"holding {} samples for {} more windows", p90, budget,
+				(int) levels_[level_], hold_);
+			return;
+		}
+
+		raised_ = true;
+		change(level_ + 1, p90);
+	} else {
+		dlg_info("SampleController: p90 {} ms, budget {} ms: keeping {} samples",
+			p90, budget, (int) levels_[level_]);
+	}
+}
+
+void SampleController::change(unsigned int level, float p90)
+{
+	dlg_info("SampleController: p90 {} ms, budget {} ms: {} -> {} samples",
+		p90, settings_.budget, (int) levels_[level_], (int) levels_[level]);
+
+	level_ = level;
+	stable_ = 0;
+	renderer_.samples(levels_[level]);
+}
+
+void SampleController::resync(vk::SampleCountBits samples)
+{
+	// continue from the highest supported level not above it and
+	// don't raise again right away
+	auto level = 0u;
+	for(auto i = 0u; i < levels_.size(); ++i) {
+		if(levels_[i] <= samples) {
+			level = i;
+		}
+	}
+
+	dlg_info("SampleController: switched to {} samples manually, "
+		"continuing from {} samples", (int) samples, (int) levels_[level]);
+
+	level_ = level;
+	stable_ = 0;
+	raised_ = false;
+	hold_ = holdBase_;
+	if(levels_[level] != samples) {
+		renderer_.samples(levels_[level]);
+	}
+}
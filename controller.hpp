@@ -0,0 +1,68 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <stats.hpp> // SampleStats
+#include <vpp/vk.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+class Renderer;
+
+/// Settings of a SampleController.
+struct SampleControllerSettings {
+	/// Frame time budget in milliseconds.
+	float budget = 16.6f;
+	/// The sample count is raised when the p90 frame time falls below
+	/// budget * raiseThreshold. The gap to the budget is the hysteresis,
+	/// since a higher sample count will increase the frame time.
+	float raiseThreshold = 0.5f;
+	/// Number of frames measured for every decision.
+	unsigned int window = 60;
+	/// Number of windows to wait before raising again after the
+	/// sample count had to be lowered. Doubles every time a raise
+	/// has to be undone, to avoid oscillation.
+	unsigned int holdWindows = 2;
+};
+
+/// Closed loop controller that raises or lowers the sample count of
+/// a renderer to hold a frame time budget.
+/// Uses the gpu time of the frames if timestamps are available, otherwise
+/// the time between two frames. Logs every decision.
+class SampleController {
+public:
+	SampleController(Renderer&, const SampleControllerSettings& = {});
+
+	/// Should be called once after every rendered frame.
+	void update();
+
+	const SampleControllerSettings& settings() const { return settings_; }
+
+protected:
+	void decide(float p90);
+	void change(unsigned int level, float p90);
+	/// Continues from a sample count requested by someone else.
+	void resync(vk::SampleCountBits);
+
+protected:
+	using Clock = std::chrono::steady_clock;
+
+	Renderer& renderer_;
+	SampleControllerSettings settings_;
+	std::vector<vk::SampleCountBits> levels_; // supported, ascending
+	unsigned int level_ {}; // current index in levels_
+
+	SampleStats times_;
+	std::uint64_t lastCompleted_ {};
+	std::uint64_t firstFrame_ {}; // first frame with the current sample count
+	Clock::time_point lastUpdate_ {};
+
+	unsigned int hold_ {}; // windows left before raising is allowed
+	unsigned int holdBase_ {}; // current hold after a lowering
+	bool raised_ {}; // whether the last change was a raise
+	unsigned int stable_ {}; // windows since the last change
+};
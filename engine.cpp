@@ -5,6 +5,8 @@
 #include <engine.hpp>
 #include <window.hpp>
 #include <render.hpp>
+#include <limiter.hpp>
+#include <trace.hpp>
 
 #include <ny/backend.hpp> // ny::Backend
 #include <ny/appContext.hpp> // ny::AppContext
@@ -15,12 +17,13 @@
 #include <vpp/device.hpp> // vpp::Device
 #include <vpp/queue.hpp> // vpp::Queue
 #include <vpp/swapchain.hpp> // vpp::Swapchain
-#include <vpp/renderer.hpp> // vpp::SwapchainRenderer
 #include <vpp/debugReport.hpp> // vpp::DebugCallback
 
 #include <dlg/dlg.hpp> // dlg
 
 #include <chrono>
+#include <future>
+#include <vector>
 using Clock = std::chrono::high_resolution_clock;
 
 struct Engine::Impl {
@@ -31,33 +34,156 @@ struct Engine::Impl {
 	std::unique_ptr<vpp::Device> device;
 
 	MainWindowListener windowListener;
+	std::unique_ptr<FrameStream> capture {}; // must outlive the renderer
 	std::unique_ptr<Renderer> renderer {};
+	std::unique_ptr<SampleController> sampleController {};
+	std::unique_ptr<FrameLimiter> frameLimiter {};
+	PhaseTimer startup;
 
 	Impl(Engine& engine) : windowListener(engine) {}
 };
 
-Engine::Engine()
+// Creates a device with a queue that supports graphics and, if surface
+// is valid, presenting on the given surface. Uses the first physical device
+// that has such a queue.
+// Also creates a queue of a dedicated transfer family (transfer but
+// neither graphics nor compute) if there is one, otherwise transfer is set
+// to the graphics queue.
+// If pipelineStatistics is true, will enable the pipelineStatisticsQuery
+// feature if supported and set pipelineStatistics to whether it was enabled.
+std::unique_ptr<vpp::Device> createDevice(const vpp::Instance& ini,
+	vk::SurfaceKHR surface, const vpp::Queue*& queue,
+	const vpp::Queue*& transfer, bool& pipelineStatistics)
+{
+	const char* swapchainExtension = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+	for(auto phdev : vk::enumeratePhysicalDevices(ini)) {
+		auto qprops = vk::getPhysicalDeviceQueueFamilyProperties(phdev);
+		for(auto i = 0u; i < qprops.size(); ++i) {
+			if(!(qprops[i].queueFlags & vk::QueueBits::graphics)) {
+				continue;
+			}
+
+			if(surface && !vk::getPhysicalDeviceSurfaceSupportKHR(phdev, i, surface)) {
+				continue;
+			}
+
+			float priority = 1.f;
+			vk::DeviceQueueCreateInfo queueInfos[2] {};
+			queueInfos[0].queueFamilyIndex = i;
+			queueInfos[0].queueCount = 1;
+			queueInfos[0].pQueuePriorities = &priority;
+
+			auto queueCount = 1u;
+			auto transferFamily = i;
+			for(auto j = 0u; j < qprops.size(); ++j) {
+				auto flags = qprops[j].queueFlags;
+				if((flags & vk::QueueBits::transfer) &&
+						!(flags & vk::QueueBits::graphics) &&
+						!(flags & vk::QueueBits::compute)) {
+					transferFamily = j;
+					queueInfos[1].queueFamilyIndex = j;
+					queueInfos[1].queueCount = 1;
+					queueInfos[1].pQueuePriorities = &priority;
+					++queueCount;
+					break;
+				}
+			}
+
+			vk::PhysicalDeviceFeatures features {};
+			if(pipelineStatistics) {
+				auto supported = vk::getPhysicalDeviceFeatures(phdev);
+				pipelineStatistics = supported.pipelineStatisticsQuery;
+				features.pipelineStatisticsQuery = pipelineStatistics;
+				if(!pipelineStatistics) {
+					dlg_warn("Device does not support pipeline statistics");
+				}
+			}
+
+			vk::DeviceCreateInfo devInfo;
+			devInfo.queueCreateInfoCount = queueCount;
+			devInfo.pQueueCreateInfos = queueInfos;
+			devInfo.pEnabledFeatures = &features;
+			if(surface) {
+				devInfo.enabledExtensionCount = 1;
+				devInfo.ppEnabledExtensionNames = &swapchainExtension;
+			}
+
+			auto dev = std::make_unique<vpp::Device>(ini, phdev, devInfo);
+			queue = dev->queue(i);
+			transfer = dev->queue(transferFamily);
+			return dev;
+		}
+	}
+
+	throw std::runtime_error("Engine: no vulkan device with a suitable queue");
+}
+
+Engine::Engine(const EngineSettings& settings) : settings_(settings)
 {
-	// for now hardcoded stuff
-	constexpr auto startSize = nytl::Vec2ui{1100, 800};
-	constexpr auto useValidation = true;
-	constexpr auto startMsaa = vk::SampleCountBits::e1;
 	constexpr auto layerName = "VK_LAYER_LUNARG_standard_validation";
 
 	impl_ = std::make_unique<Impl>(*this);
 
-	// ny backend and appContext
-	auto& backend = ny::Backend::choose();
-	if(!backend.vulkan()) {
-		throw std::runtime_error("Engine: ny backend has no vulkan support!");
+	// tracing
+	// started before everything else to include the initialization
+	if(!settings_.traceFile.empty()) {
+#ifdef ENABLE_TRACE
+		TRACE_THREAD_NAME("main");
+		traceStart();
+#else
+		dlg_warn("Engine: built without trace support (meson option 'trace')");
+		settings_.traceFile.clear();
+#endif
 	}
 
-	impl_->appContext = backend.createAppContext();
+	// background tasks
+	// reading the pipeline cache and generating the scene don't need
+	// a device, they overlap with the window and device creation
+	using msf = std::chrono::duration<float, std::milli>;
+	auto& startup = impl_->startup;
+	auto cacheTime = 0.f;
+	auto sceneTime = 0.f;
+	auto cacheFile = RendererSettings {}.pipelineCache;
+	auto cacheTask = std::async(std::launch::async, [&]{
+		TRACE_SCOPE("read pipeline cache");
+		auto start = Clock::now();
+		auto data = PipelineStore::readCacheFile(cacheFile);
+		cacheTime = msf(Clock::now() - start).count();
+		return data;
+	});
+
+	auto sceneTask = std::async(std::launch::async, [&]{
+		TRACE_SCOPE("generate scene");
+		auto start = Clock::now();
+		std::vector<Instance> instances;
+		if(settings_.scene.mesh.empty()) {
+			instances = generateInstances(settings_.scene);
+		}
+
+		sceneTime = msf(Clock::now() - start).count();
+		return instances;
+	});
+
+	startup.end("start background tasks");
+
+	// ny backend and appContext
+	std::vector<const char*> iniExtensions;
+	if(!headless()) {
+		auto& backend = ny::Backend::choose();
+		if(!backend.vulkan()) {
+			throw std::runtime_error("Engine: ny backend has no vulkan support!");
+		}
+
+		impl_->appContext = backend.createAppContext();
+		iniExtensions = impl_->appContext->vulkanExtensions();
+		startup.end("ny backend");
+	}
 
 	// vulkan init
 	// instance
-	auto iniExtensions = impl_->appContext->vulkanExtensions();
-	iniExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+	if(settings_.validation) {
+		iniExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+	}
 
 	vk::ApplicationInfo appInfo ("msaa-triangle", 1, "msaa-triangle", 1, VK_API_VERSION_1_0);
 	vk::InstanceCreateInfo instanceInfo;
@@ -66,7 +192,7 @@ Engine::Engine()
 	instanceInfo.enabledExtensionCount = iniExtensions.size();
 	instanceInfo.ppEnabledExtensionNames = iniExtensions.data();
 
-	if(useValidation) {
+	if(settings_.validation) {
 		instanceInfo.enabledLayerCount = 1;
 		instanceInfo.ppEnabledLayerNames = &layerName;
 	}
@@ -83,31 +209,103 @@ Engine::Engine()
 	}
 
 	// debug callback
-	if(useValidation) {
+	if(settings_.validation) {
 		impl_->debugCallback = std::make_unique<vpp::DebugCallback>(impl_->instance);
 	}
 
-	// init ny window
+	startup.end(settings_.validation ? "instance (validation)" : "instance");
+
+	RendererSettings rendererSettings;
+	rendererSettings.samples = static_cast<vk::SampleCountBits>(settings_.samples);
+	rendererSettings.resolve = settings_.resolve;
+	rendererSettings.dynamicResolution = settings_.dynamicResolution;
+	rendererSettings.renderScale = settings_.renderScale;
+	rendererSettings.size = settings_.size;
+	rendererSettings.presentMode = settings_.presentMode;
+	rendererSettings.imageCount = settings_.imageCount;
+	rendererSettings.framesInFlight = settings_.framesInFlight;
+	rendererSettings.pipelineStatistics = settings_.pipelineStatistics;
+	rendererSettings.prewarmPipelines = settings_.prewarmPipelines;
+	rendererSettings.recordThreads = settings_.recordThreads;
+	rendererSettings.scene = settings_.scene;
+
+	rendererSettings.readback = settings_.readback;
+	if(!settings_.captureFile.empty()) {
+		impl_->capture = std::make_unique<FrameStream>(settings_.captureFile,
+			settings_.captureRing);
+		rendererSettings.readback = [stream = impl_->capture.get(),
+				sink = settings_.readback](const ReadbackFrame& frame) {
+			stream->write(frame);
+			if(sink) {
+				sink(frame);
+			}
+		};
+	}
+
+	const vpp::Queue* queue {};
+	const vpp::Queue* transfer {};
+
+	// headless: no window, no surface
 	auto vkSurface = vk::SurfaceKHR {};
-	auto ws = ny::WindowSettings {};
+	if(headless()) {
+		dlg_info("Engine: running headless");
+	} else {
+		// init ny window
+		auto ws = ny::WindowSettings {};
+
+		ws.surface = ny::SurfaceType::vulkan;
+		ws.listener = &impl_->windowListener;
+		ws.size = settings_.size;
+		ws.vulkan.instance = (VkInstance) impl_->instance.vkHandle();
+		ws.vulkan.storeSurface = &(std::uintptr_t&) (vkSurface);
+
+		impl_->windowContext = impl_->appContext->createWindowContext(ws);
+		startup.end("window");
+	}
 
-	ws.surface = ny::SurfaceType::vulkan;
-	ws.listener = &impl_->windowListener;
-	ws.size = startSize;
-	ws.vulkan.instance = (VkInstance) impl_->instance.vkHandle();
-	ws.vulkan.storeSurface = &(std::uintptr_t&) (vkSurface);
+	impl_->device = createDevice(impl_->instance, vkSurface, queue, transfer,
+		rendererSettings.pipelineStatistics);
+	settings_.pipelineStatistics = rendererSettings.pipelineStatistics;
+	startup.end("device");
 
-	impl_->windowContext = impl_->appContext->createWindowContext(ws);
+	// usually already done
+	rendererSettings.pipelineCacheData = cacheTask.get();
+	rendererSettings.instances = sceneTask.get();
+	startup.parallel("pipeline cache read", cacheTime);
+	startup.parallel("scene generation", sceneTime);
+	startup.end("background task wait");
 
-	const vpp::Queue* presentQueue {};
-	impl_->device = std::make_unique<vpp::Device>(impl_->instance,
-		vkSurface, presentQueue);
 	impl_->renderer = std::make_unique<Renderer>(*impl_->device,
-		vkSurface, startMsaa, *presentQueue);
+		vkSurface, *queue, rendererSettings, transfer);
+	startup.end("renderer");
+	logStartup();
+}
+
+void Engine::logStartup()
+{
+	auto log = [](const PhaseTimer& timer, const char* indent) {
+		for(auto& phase : timer.phases()) {
+			dlg_info("{}{}: {} ms{}", indent, phase.name, phase.duration,
+				phase.parallel ? " (in parallel)" : "");
+		}
+	};
+
+	dlg_info("Startup took {} ms", impl_->startup.total());
+	log(impl_->startup, "\t");
+	dlg_info("\trenderer phases:");
+	log(renderer().startupTimes(), "\t\t");
 }
 
 Engine::~Engine()
 {
+	// the gpu spans are read when the frames complete
+	if(!settings_.traceFile.empty()) {
+		if(impl_->renderer) {
+			impl_->renderer->wait();
+		}
+
+		traceWrite(settings_.traceFile);
+	}
 }
 
 void Engine::mainLoop()
@@ -122,30 +320,129 @@ void Engine::mainLoop()
 
 	run_ = true;
 
+	if(settings_.adaptiveSamples && !impl_->sampleController) {
+		impl_->sampleController = std::make_unique<SampleController>(
+			renderer(), settings_.sampleController);
+	}
+
+	auto& limiterSettings = settings_.frameLimiter;
+	if(limiterSettings.fps > 0.f && !impl_->frameLimiter) {
+		impl_->frameLimiter = std::make_unique<FrameLimiter>(limiterSettings);
+	}
+
 	// TODO: to make this work on android an additional idle-check
 	// loop is needed. See other android-working implementations using ny and
 	// vpp for examples.
+	auto frameCount = 0u;
+	auto onDemand = settings_.onDemand && !headless();
 	while(run_) {
-		if(!impl_->appContext->pollEvents()) {
+		// events are polled after the wake up so that the frame
+		// uses the latest input
+		if(impl_->frameLimiter) {
+			impl_->frameLimiter->wait();
+		}
+
+		auto polled = true;
+		if(!headless()) {
+			TRACE_SCOPE("pollEvents");
+			polled = impl_->appContext->pollEvents();
+		}
+
+		if(!polled) {
 			dlg_info("pollEvents returned false");
 			return;
 		}
 
+		// block until an event changes what we render
+		if(onDemand && !renderer().redrawNeeded()) {
+			if(!impl_->appContext->waitEvents()) {
+				dlg_info("waitEvents returned false");
+				return;
+			}
+
+			// the events may have stopped the engine or not caused
+			// any damage (e.g. mouse movement).
+			// Idle time is not counted for the fps output
+			lastFrame = Clock::now();
+			continue;
+		}
+
 		auto now = Clock::now();
 		auto deltaCount = std::chrono::duration_cast<secf>(now - lastFrame).count();
 		lastFrame = now;
 
-		renderer().renderStall();
+		renderer().render();
+		if(impl_->frameLimiter) {
+			auto gpuTime = renderer().timestamps() ? renderer().lastGpuTime() : 0.f;
+			impl_->frameLimiter->finish(gpuTime);
+		}
+
+		if(impl_->sampleController) {
+			impl_->sampleController->update();
+		}
 
 		if(printFrames) {
 			++fpsCounter;
 			secCounter += deltaCount;
 			if(secCounter >= 1.f) {
-				dlg_info("{} fps", fpsCounter);
+				dlg_info("{} fps, queue depth {}", fpsCounter,
+					renderer().queueDepth());
+				logFrameStats();
 				secCounter = 0.f;
 				fpsCounter = 0;
 			}
 		}
+
+		++frameCount;
+		if(settings_.frameCount && frameCount >= settings_.frameCount) {
+			dlg_info("Rendered {} frames, exiting", frameCount);
+			renderer().wait();
+			logMemoryReport();
+			run_ = false;
+		}
+	}
+}
+
+void Engine::logFrameStats()
+{
+	auto stats = renderer().frameStats();
+	dlg_info("\tcpu: {} min, {} avg, {} p99 (ms)",
+		stats.cpu.min, stats.cpu.avg, stats.cpu.p99);
+	if(!headless()) {
+		auto latency = renderer().presentLatency();
+		dlg_info("\tlatency: up to {} frames, {} ms ({})", latency,
+			latency * stats.interval.avg, name(renderer().presentMode()));
+	}
+
+	if(stats.gpu.count) {
+		dlg_info("\tgpu: {} min, {} avg, {} p99 (ms)",
+			stats.gpu.min, stats.gpu.avg, stats.gpu.p99);
+		dlg_info("\tresolve: {} min, {} avg, {} p99 (ms)",
+			stats.resolve.min, stats.resolve.avg, stats.resolve.p99);
+	}
+
+	if(settings_.pipelineStatistics) {
+		auto& ps = renderer().pipelineStatistics();
+		dlg_info("\tvertices: {}, fragment invocations: {}",
+			ps.inputAssemblyVertices, ps.fragmentShaderInvocations);
+	}
+
+	renderer().resetFrameStats();
+}
+
+void Engine::logMemoryReport()
+{
+	constexpr auto mib = 1024.f * 1024.f;
+	auto report = renderer().memoryReport();
+	dlg_info("Memory usage: {} MiB total", report.total / mib);
+	for(auto& entry : report.entries) {
+		if(entry.lazy) {
+			dlg_info("\t{}: {} MiB lazily allocated, {} MiB committed",
+				entry.name, entry.size / mib, entry.committed / mib);
+		} else {
+			dlg_info("\t{}: {} MiB{}", entry.name, entry.size / mib,
+				entry.owned ? "" : " (estimated)");
+		}
 	}
 }
 
@@ -7,18 +7,87 @@
 #include <ny/fwd.hpp>
 #include <vpp/fwd.hpp>
 #include <nytl/vec.hpp>
+#include <scene.hpp> // SceneSettings
+#include <resolve.hpp> // ResolveMode
+#include <controller.hpp> // SampleControllerSettings
+#include <limiter.hpp> // FrameLimiterSettings
+#include <readback.hpp> // ReadbackSink
 #include <memory>
+#include <string>
 
 class Renderer;
 
+/// Settings the Engine is started with.
+struct EngineSettings {
+	/// Whether to render into offscreen images without any window system.
+	/// In this mode no ny backend is used at all.
+	bool headless = false;
+	/// Whether to enable the validation layer (and debug callback).
+	bool validation = true;
+	/// Initial (in headless mode: fixed) size of the render targets.
+	nytl::Vec2ui size = {1100, 800};
+	/// Initial present mode and swapchain image count (0 for the default).
+	/// Can be changed at runtime, see Renderer::presentMode.
+	vk::PresentModeKHR presentMode = vk::PresentModeKHR::fifo;
+	unsigned int imageCount = 0;
+	/// Initial multisample count, must be 1, 2, 4 or 8.
+	unsigned int samples = 1;
+	/// Initial resolve mode.
+	ResolveMode resolve = ResolveMode::renderPass;
+	/// Whether to adjust the sample count automatically to hold the
+	/// frame time budget given in sampleController.
+	bool adaptiveSamples = false;
+	SampleControllerSettings sampleController;
+	/// Whether to render at a fraction of the target size and upscale
+	/// the result, see Renderer::renderScale.
+	bool dynamicResolution = false;
+	/// Initial render scale, only used with dynamicResolution.
+	float renderScale = 1.f;
+	/// Whether to only render when the content changed (e.g. resize, sample
+	/// count switch, animation) and block waiting for events otherwise.
+	/// Continuous rendering (the default) is needed for benchmarking.
+	/// Has no effect in headless mode.
+	bool onDemand = false;
+	/// Frame rate limit and pacing, the limiter is only used if a
+	/// target frame rate is set.
+	FrameLimiterSettings frameLimiter;
+	/// Number of frames to render before mainLoop returns, 0 for no limit.
+	unsigned int frameCount = 0;
+	/// Maximum number of frames the cpu may be ahead of the gpu.
+	/// 1 means that the cpu waits for every frame to complete.
+	unsigned int framesInFlight = 2;
+	/// Whether to query (and log) pipeline statistics, if supported.
+	bool pipelineStatistics = false;
+	/// Whether to compile the pipelines for all sample counts at startup.
+	bool prewarmPipelines = true;
+	/// Number of threads recording the draws into secondary command
+	/// buffers, 0 to record them directly on the render thread.
+	unsigned int recordThreads = 0;
+	/// The scene to render.
+	SceneSettings scene;
+	/// File to stream all rendered frames to, empty for none.
+	/// See FrameStream for the format.
+	std::string captureFile;
+	/// If not 0, the capture file is a ring of that many frames.
+	unsigned int captureRing = 0;
+	/// Called with every rendered frame (after writing it to the capture
+	/// file), e.g. to compare it against a reference. Empty for none.
+	ReadbackSink readback;
+	/// File to write a chrome trace of the cpu and gpu frame phases to
+	/// when the engine is destroyed, empty for none.
+	/// Requires building with the meson option 'trace'.
+	std::string traceFile;
+};
+
 /// Central Engine class.
 /// Hirachy root, manages all other classes.
 /// Entrypoint class from the main function.
 class Engine {
 public:
-	Engine();
+	Engine(const EngineSettings& settings = {});
 	~Engine();
 
+	/// The ny contexts. Must not be called in headless mode.
 	ny::AppContext& appContext() const;
 	ny::WindowContext& windowContext() const;
 
@@ -31,8 +100,20 @@ public:
 	void mainLoop();
 	void stop();
 
+	/// Logs the device memory used by the renderer.
+	void logMemoryReport();
+
+	const EngineSettings& settings() const { return settings_; }
+	bool headless() const { return settings_.headless; }
+
+protected:
+	void logFrameStats();
+	/// Logs the durations of the startup phases.
+	void logStartup();
+
 protected:
 	struct Impl;
 	std::unique_ptr<Impl> impl_;
+	EngineSettings settings_;
 	bool run_;
 };
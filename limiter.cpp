@@ -0,0 +1,85 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <limiter.hpp>
+#include <dlg/dlg.hpp> // dlg
+#include <algorithm> // std::max
+#include <thread> // std::this_thread
+
+using msf = std::chrono::duration<float, std::milli>;
+
+FrameLimiter::FrameLimiter(const FrameLimiterSettings& settings)
+	: settings_(settings)
+{
+	if(settings_.fps <= 0.f) {
+		if(settings_.lateLatch) {
+			dlg_warn("FrameLimiter: late latch requires a target frame rate");
+			settings_.lateLatch = false;
+		}
+
+		return;
+	}
+
+	period_ = std::chrono::duration_cast<Clock::duration>(
+		msf(1000.f / settings_.fps));
+	dlg_info("FrameLimiter: limiting to {} fps{}", settings_.fps,
+		settings_.lateLatch ? ", late latch" : "");
+}
+
+void FrameLimiter::wait()
+{
+	if(period_ == Clock::duration {}) {
+		wakeup_ = Clock::now();
+		return;
+	}
+
+	// the slot of this frame starts at the previous deadline.
+	// When more than a frame behind, we don't try to catch up
+	// since that would just result in a burst of frames
+	auto now = Clock::now();
+	auto start = deadline_;
+	if(deadline_ == Clock::time_point {} || now > deadline_ + period_) {
+		start = now;
+	}
+
+	deadline_ = start + period_;
+
+	// late latch: start as late as possible while still finishing
+	// before the deadline
+	auto wakeup = start;
+	if(settings_.lateLatch) {
+		auto reserve = std::chrono::duration_cast<Clock::duration>(
+			msf(estimate_ + settings_.margin));
+		wakeup = std::max(start, deadline_ - reserve);
+	}
+
+	waitUntil(wakeup);
+	wakeup_ = Clock::now();
+}
+
+void FrameLimiter::finish(float gpuTime)
+{
+	// cpu and gpu work overlap partially, the sum is conservative.
+	// Rises immediately but decays slowly, a missed deadline is
+	// worse than a bit of additional latency
+	auto sample = msf(Clock::now() - wakeup_).count() + gpuTime;
+	if(sample > estimate_) {
+		estimate_ = sample;
+	} else {
+		estimate_ = 0.95f * estimate_ + 0.05f * sample;
+	}
+}
+
+void FrameLimiter::waitUntil(Clock::time_point point)
+{
+	auto spin = std::chrono::duration_cast<Clock::duration>(
+		msf(settings_.spinThreshold));
+	if(point - Clock::now() > spin) {
+		std::this_thread::sleep_until(point - spin);
+	}
+
+	while(Clock::now() < point) {
+		std::this_thread::yield();
+	}
+}
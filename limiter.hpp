@@ -0,0 +1,58 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <chrono>
+
+/// Settings of a FrameLimiter.
+struct FrameLimiterSettings {
+	/// Target frame rate, 0 for no limit.
+	float fps = 0.f;
+	/// Whether to start the frames as late as the measured frame time
+	/// allows instead of right after the previous deadline. Input is then
+	/// sampled closer to the present. Requires a target frame rate.
+	bool lateLatch = false;
+	/// Time in milliseconds before the wake up time from which on
+	/// the limiter spins instead of sleeping, since sleeping may
+	/// overshoot by about the scheduler granularity.
+	float spinThreshold = 2.f;
+	/// Additional time in milliseconds reserved for a late latched frame
+	/// to absorb variance of the frame time.
+	float margin = 1.f;
+};
+
+/// Paces the frames of a loop to a target frame rate.
+/// The deadlines advance by a fixed period (instead of being relative
+/// to the wake up) so that sleep inaccuracies don't accumulate.
+/// Should be used as: wait(), sample input, render, finish(gpuTime).
+class FrameLimiter {
+public:
+	FrameLimiter(const FrameLimiterSettings&);
+
+	/// Blocks until the next frame should be started.
+	void wait();
+
+	/// Should be called after the frame was submitted, with the
+	/// gpu time of the last completed frame in milliseconds (0 if
+	/// not known). Updates the frame time estimate for late latching.
+	void finish(float gpuTime);
+
+	/// Returns the estimated time (cpu + gpu) a frame needs in ms.
+	float estimate() const { return estimate_; }
+	const FrameLimiterSettings& settings() const { return settings_; }
+
+protected:
+	using Clock = std::chrono::steady_clock;
+
+	/// Sleeps until shortly before the given time point, then spins.
+	void waitUntil(Clock::time_point);
+
+protected:
+	FrameLimiterSettings settings_;
+	Clock::duration period_ {};
+	Clock::time_point deadline_ {}; // end of the current frame
+	Clock::time_point wakeup_ {}; // when the current frame was started
+	float estimate_ {}; // in ms
+};
@@ -3,9 +3,179 @@
 // See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
 
 #include "engine.hpp"
+#include "render.hpp" // parsePresentMode
+#include "raster.hpp" // CpuRasterizer
+#include "mesh.hpp" // writeMesh
+#include <dlg/dlg.hpp> // dlg
 
-int main(int, char**)
+#include <chrono>
+#include <cstdlib> // std::strtoul, std::strtof
+#include <cstring> // std::strcmp
+#include <cstdio> // std::sscanf
+
+// Parses the command line into the given settings.
+// cpuRender is set to the output file if the scene should only be
+// rendered once on the cpu, meshFile if it should only be written as
+// mesh. Returns false on invalid arguments.
+bool parseArgs(int argc, char** argv, EngineSettings& settings,
+		std::string& cpuRender, std::string& meshFile)
+{
+	for(auto i = 1; i < argc; ++i) {
+		auto arg = argv[i];
+		auto hasValue = i + 1 < argc;
+
+		if(!std::strcmp(arg, "--headless")) {
+			settings.headless = true;
+		} else if(!std::strcmp(arg, "--no-validation")) {
+			settings.validation = false;
+		} else if(!std::strcmp(arg, "--pipeline-statistics")) {
+			settings.pipelineStatistics = true;
+		} else if(!std::strcmp(arg, "--samples") && hasValue) {
+			settings.samples = std::strtoul(argv[++i], nullptr, 10);
+		} else if(!std::strcmp(arg, "--resolve") && hasValue) {
+			if(!parseResolveMode(argv[++i], settings.resolve)) {
+				dlg_error("Invalid resolve mode '{}'", argv[i]);
+				return false;
+			}
+		} else if(!std::strcmp(arg, "--frame-budget") && hasValue) {
+			settings.adaptiveSamples = true;
+			settings.sampleController.budget = std::strtof(argv[++i], nullptr);
+		} else if(!std::strcmp(arg, "--dynamic-resolution")) {
+			settings.dynamicResolution = true;
+		} else if(!std::strcmp(arg, "--render-scale") && hasValue) {
+			settings.dynamicResolution = true;
+			settings.renderScale = std::strtof(argv[++i], nullptr);
+		} else if(!std::strcmp(arg, "--present-mode") && hasValue) {
+			if(!parsePresentMode(argv[++i], settings.presentMode)) {
+				dlg_error("Invalid present mode '{}'", argv[i]);
+				return false;
+			}
+		} else if(!std::strcmp(arg, "--swapchain-images") && hasValue) {
+			settings.imageCount = std::strtoul(argv[++i], nullptr, 10);
+		} else if(!std::strcmp(arg, "--on-demand")) {
+			settings.onDemand = true;
+		} else if(!std::strcmp(arg, "--fps") && hasValue) {
+			settings.frameLimiter.fps = std::strtof(argv[++i], nullptr);
+		} else if(!std::strcmp(arg, "--late-latch")) {
+			settings.frameLimiter.lateLatch = true;
+		} else if(!std::strcmp(arg, "--trace") && hasValue) {
+			settings.traceFile = argv[++i];
+		} else if(!std::strcmp(arg, "--capture") && hasValue) {
+			settings.captureFile = argv[++i];
+		} else if(!std::strcmp(arg, "--capture-ring") && hasValue) {
+			settings.captureRing = std::strtoul(argv[++i], nullptr, 10);
+		} else if(!std::strcmp(arg, "--cpu-render") && hasValue) {
+			cpuRender = argv[++i];
+		} else if(!std::strcmp(arg, "--frames") && hasValue) {
+			settings.frameCount = std::strtoul(argv[++i], nullptr, 10);
+		} else if(!std::strcmp(arg, "--triangles") && hasValue) {
+			settings.scene.count = std::strtoul(argv[++i], nullptr, 10);
+			if(settings.scene.count == 0) {
+				dlg_error("Invalid triangle count '{}', must be at least 1", argv[i]);
+				return false;
+			}
+		} else if(!std::strcmp(arg, "--triangle-size") && hasValue) {
+			settings.scene.size = std::strtof(argv[++i], nullptr);
+		} else if(!std::strcmp(arg, "--overlap") && hasValue) {
+			settings.scene.overlap = std::strtof(argv[++i], nullptr);
+		} else if(!std::strcmp(arg, "--edge-density") && hasValue) {
+			settings.scene.edgeDensity = std::strtof(argv[++i], nullptr);
+		} else if(!std::strcmp(arg, "--draws") && hasValue) {
+			settings.scene.draws = std::strtoul(argv[++i], nullptr, 10);
+		} else if(!std::strcmp(arg, "--record-threads") && hasValue) {
+			settings.recordThreads = std::strtoul(argv[++i], nullptr, 10);
+		} else if(!std::strcmp(arg, "--mesh") && hasValue) {
+			settings.scene.mesh = argv[++i];
+		} else if(!std::strcmp(arg, "--write-mesh") && hasValue) {
+			meshFile = argv[++i];
+		} else if(!std::strcmp(arg, "--stream-budget") && hasValue) {
+			auto mib = std::strtof(argv[++i], nullptr);
+			settings.scene.streamBudget = vk::DeviceSize(mib * 1024 * 1024);
+		} else if(!std::strcmp(arg, "--vertex-format") && hasValue) {
+			VertexFormat format;
+			if(!parseVertexFormat(argv[++i], format)) {
+				dlg_error("Invalid vertex format '{}'", argv[i]);
+				return false;
+			}
+
+			settings.scene.vertexFormat = format;
+		} else if(!std::strcmp(arg, "--animate")) {
+			settings.scene.animate = true;
+		} else if(!std::strcmp(arg, "--frames-in-flight") && hasValue) {
+			settings.framesInFlight = std::strtoul(argv[++i], nullptr, 10);
+		} else if(!std::strcmp(arg, "--size") && hasValue) {
+			if(std::sscanf(argv[++i], "%ux%u", &settings.size.x, &settings.size.y) != 2) {
+				dlg_error("Invalid size '{}', expected e.g. 1920x1080", argv[i]);
+				return false;
+			}
+		} else {
+			dlg_error("Invalid argument '{}'", arg);
+			return false;
+		}
+	}
+
+	if(settings.framesInFlight == 0) {
+		dlg_error("At least one frame must be in flight");
+		return false;
+	}
+
+	auto s = settings.samples;
+	if(s != 1 && s != 2 && s != 4 && s != 8) {
+		dlg_error("Invalid sample count {}", s);
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv)
 {
-	Engine engine;
+	EngineSettings settings;
+	std::string cpuRender;
+	std::string meshFile;
+	if(!parseArgs(argc, argv, settings, cpuRender, meshFile)) {
+		dlg_info("usage: triangle [--headless] [--no-validation] "
+			"[--pipeline-statistics] [--samples <n>] "
+			"[--resolve renderpass|box|tent|tonemap|fxaa] [--frame-budget <ms>] "
+			"[--dynamic-resolution] [--render-scale <f>] "
+			"[--present-mode fifo|fifo-relaxed|mailbox|immediate] [--swapchain-images <n>] "
+			"[--on-demand] "
+			"[--fps <f>] [--late-latch] "
+			"[--trace <file.json>] "
+			"[--capture <file>] [--capture-ring <n>] "
+			"[--frames <n>] [--frames-in-flight <n>] [--size <w>x<h>] "
+			"[--triangles <n>] [--triangle-size <f>] [--overlap <f>] "
+			"[--edge-density <f>] [--draws <n>] [--animate] "
+			"[--record-threads <n>] [--cpu-render <file.ppm>] "
+			"[--mesh <file>] [--write-mesh <file>] [--stream-budget <MiB>] "
+			"[--vertex-format float32|half|packed]");
+		return EXIT_FAILURE;
+	}
+
+	// bake the generated scene into a mesh file
+	if(!meshFile.empty()) {
+		return writeMesh(meshFile, settings.scene) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// render without vulkan, e.g. on hosts without gpu
+	if(!cpuRender.empty()) {
+		if(!settings.scene.mesh.empty()) {
+			dlg_warn("The cpu renderer only renders generated scenes, ignoring the mesh");
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		CpuRasterizer raster({settings.size.x, settings.size.y},
+			static_cast<vk::SampleCountBits>(settings.samples));
+		raster.render(triangleVertices, triangleVertexCount,
+			generateInstances(settings.scene));
+
+		auto duration = std::chrono::duration<float, std::milli>(
+			std::chrono::steady_clock::now() - start).count();
+		dlg_info("Rendered on the cpu in {} ms", duration);
+		auto ok = writePpm(cpuRender, raster.extent(), raster.image().data());
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	Engine engine(settings);
 	engine.mainLoop();
 }
@@ -0,0 +1,364 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <mesh.hpp>
+#include <dlg/dlg.hpp> // dlg
+#include <algorithm> // std::min, std::max, std::clamp
+#include <cmath> // std::round
+#include <cstdio> // std::fopen
+#include <cstring> // std::memcmp, std::memcpy
+#include <limits>
+#include <stdexcept> // std::runtime_error
+
+#ifdef _WIN32
+	#include <fstream> // std::ifstream
+	#include <iterator> // std::istreambuf_iterator
+#else
+	#include <fcntl.h> // open
+	#include <sys/mman.h> // mmap
+	#include <sys/stat.h> // fstat
+	#include <unistd.h> // close
+#endif
+
+namespace {
+
+// position of vertex v of the triangle transformed with the given
+// instance, see triangle.vert
+nytl::Vec2f transform(const Instance& ini, unsigned int v)
+{
+	auto vert = triangleVertices + v * 5;
+	auto x = ini.scale.x * vert[0];
+	auto y = ini.scale.y * vert[1];
+	auto& r = ini.rotation;
+	return {ini.offset.x + (r.x * x - r.y * y), ini.offset.y + (r.y * x + r.x * y)};
+}
+
+// final color of channel c of vertex v with the given instance,
+// see triangle.vert
+float color(const Instance& ini, unsigned int v, unsigned int c)
+{
+	const float base[] = {0.7f, 0.5f, 0.f};
+	auto vert = triangleVertices + v * 5;
+	return ini.tint * (0.45f * vert[2 + c] + 0.4f * base[c]);
+}
+
+std::int16_t snorm16(float value)
+{
+	return static_cast<std::int16_t>(std::round(
+		std::clamp(value, -1.f, 1.f) * 32767.f));
+}
+
+std::uint8_t unorm8(float value)
+{
+	return static_cast<std::uint8_t>(std::round(
+		std::clamp(value, 0.f, 1.f) * 255.f));
+}
+
+// rounds to nearest even, like the vulkan conversion
+std::uint16_t half(float value)
+{
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	std::uint32_t sign = (bits >> 16) & 0x8000u;
+	auto exp = int((bits >> 23) & 0xFFu) - 127 + 15;
+	std::uint32_t mant = bits & 0x7FFFFFu;
+
+	if(exp >= 31) { // overflow, inf or nan
+		auto nan = ((bits >> 23) & 0xFFu) == 0xFFu && mant;
+		return sign | 0x7C00u | (nan ? 0x200u : 0u);
+	} else if(exp <= 0) { // subnormal or zero
+		if(exp < -10) {
+			return sign;
+		}
+
+		mant |= 0x800000u;
+		auto shift = std::uint32_t(14 - exp);
+		auto ret = mant >> shift;
+		auto rest = mant & ((1u << shift) - 1);
+		auto halfway = 1u << (shift - 1);
+		if(rest > halfway || (rest == halfway && (ret & 1u))) {
+			++ret;
+		}
+
+		return sign | ret;
+	}
+
+	// a carry of the rounding correctly increments the exponent
+	auto ret = sign | (std::uint32_t(exp) << 10) | (mant >> 13);
+	auto rest = mant & 0x1FFFu;
+	if(rest > 0x1000u || (rest == 0x1000u && (ret & 1u))) {
+		++ret;
+	}
+
+	return ret;
+}
+
+void writeVertex(const float* position, const float* color, VertexFormat format,
+	std::uint8_t* dst)
+{
+	if(format == VertexFormat::float32) {
+		std::memcpy(dst, position, 2 * sizeof(float));
+		std::memcpy(dst + 2 * sizeof(float), color, 3 * sizeof(float));
+		return;
+	}
+
+	// half and packed have the same layout
+	PackedVertex vert;
+	for(auto i = 0u; i < 2; ++i) {
+		vert.position[i] = (format == VertexFormat::half) ?
+			half(position[i]) : snorm16(position[i]);
+	}
+
+	for(auto i = 0u; i < 3; ++i) {
+		vert.color[i] = unorm8(color[i]);
+	}
+
+	vert.color[3] = 255u;
+	std::memcpy(dst, &vert, sizeof(vert));
+}
+
+} // anon namespace
+
+void convertVertices(const PackedVertex* vertices, std::size_t count,
+	VertexFormat format, std::uint8_t* dst)
+{
+	if(format == VertexFormat::packed) {
+		std::memcpy(dst, vertices, count * sizeof(PackedVertex));
+		return;
+	}
+
+	auto size = vertexSize(format);
+	for(auto i = 0u; i < count; ++i) {
+		auto& vert = vertices[i];
+		float position[2];
+		float color[3];
+		for(auto j = 0u; j < 2; ++j) {
+			position[j] = std::max(vert.position[j] / 32767.f, -1.f);
+		}
+
+		for(auto j = 0u; j < 3; ++j) {
+			color[j] = vert.color[j] / 255.f;
+		}
+
+		writeVertex(position, color, format, dst + i * size);
+	}
+}
+
+void convertVertices(const float* vertices, std::size_t count,
+	VertexFormat format, std::uint8_t* dst)
+{
+	auto size = vertexSize(format);
+	for(auto i = 0u; i < count; ++i) {
+		auto vert = vertices + 5 * i;
+		writeVertex(vert, vert + 2, format, dst + i * size);
+	}
+}
+
+// MeshFile
+MeshFile::MeshFile(const std::string& path)
+{
+#ifdef _WIN32
+	std::ifstream in(path, std::ios::binary);
+	if(!in.is_open()) {
+		throw std::runtime_error("MeshFile: could not open " + path);
+	}
+
+	buffer_ = {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+	data_ = buffer_.data();
+	size_ = buffer_.size();
+#else
+	auto fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0) {
+		throw std::runtime_error("MeshFile: could not open " + path);
+	}
+
+	struct stat st;
+	if(::fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		throw std::runtime_error("MeshFile: could not read " + path);
+	}
+
+	// the mapping stays valid after closing the file
+	size_ = st.st_size;
+	auto ptr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(ptr == MAP_FAILED) {
+		throw std::runtime_error("MeshFile: could not map " + path);
+	}
+
+	// chunks are uploaded front to back
+	::madvise(ptr, size_, MADV_SEQUENTIAL);
+	data_ = static_cast<const std::uint8_t*>(ptr);
+#endif
+
+	try {
+		parse(path);
+	} catch(...) {
+		unmap();
+		throw;
+	}
+
+	dlg_info("MeshFile: '{}': {} triangles in {} chunks, {} MiB", path,
+		vertexCount() / 3, chunks_.size(), size_ / (1024.f * 1024.f));
+}
+
+MeshFile::~MeshFile()
+{
+	unmap();
+}
+
+void MeshFile::parse(const std::string& path)
+{
+	auto invalid = [&](const char* what) {
+		return std::runtime_error("MeshFile: '" + path + "': " + what);
+	};
+
+	if(size_ < sizeof(MeshHeader)) {
+		throw invalid("too small");
+	}
+
+	header_ = reinterpret_cast<const MeshHeader*>(data_);
+	if(std::memcmp(header_->magic, "MESH", 4) != 0) {
+		throw invalid("not a mesh file");
+	} else if(header_->version != meshVersion) {
+		throw invalid("unsupported version");
+	}
+
+	// check that all chunks are in bounds and consecutive.
+	// The count is checked first, we reserve for it
+	auto offset = sizeof(MeshHeader);
+	if(header_->chunkCount > (size_ - offset) / sizeof(MeshChunk)) {
+		throw invalid("truncated");
+	}
+
+	auto vertices = std::uint64_t(0);
+	chunks_.reserve(header_->chunkCount);
+	for(auto i = 0u; i < header_->chunkCount; ++i) {
+		if(size_ - offset < sizeof(MeshChunk)) {
+			throw invalid("truncated");
+		}
+
+		auto chunk = reinterpret_cast<const MeshChunk*>(data_ + offset);
+		offset += sizeof(MeshChunk);
+
+		auto bytes = std::uint64_t(chunk->vertexCount) * sizeof(PackedVertex);
+		if(bytes > size_ - offset) {
+			throw invalid("truncated");
+		} else if(chunk->vertexCount % 3 || chunk->firstVertex != vertices) {
+			throw invalid("invalid chunk");
+		}
+
+		auto data = reinterpret_cast<const PackedVertex*>(data_ + offset);
+		chunks_.push_back({chunk, data});
+		offset += bytes;
+		vertices += chunk->vertexCount;
+	}
+
+	if(vertices != header_->vertexCount) {
+		throw invalid("vertex count does not match the chunks");
+	}
+}
+
+void MeshFile::unmap()
+{
+#ifndef _WIN32
+	if(data_) {
+		::munmap(const_cast<std::uint8_t*>(data_), size_);
+	}
+#endif
+
+	data_ = nullptr;
+	buffer_.clear();
+}
+
+bool writeMesh(const std::string& path, const SceneSettings& settings,
+	unsigned int chunkVertices)
+{
+	chunkVertices -= chunkVertices % 3;
+	if(chunkVertices == 0) {
+		dlg_error("writeMesh: chunks must hold at least one triangle");
+		return false;
+	}
+
+	auto instances = generateInstances(settings);
+	auto vertexCount = std::uint64_t(instances.size()) * triangleVertexCount;
+
+	// the positions are quantized relative to the bounds
+	auto inf = std::numeric_limits<float>::infinity();
+	nytl::Vec2f min {inf, inf};
+	nytl::Vec2f max {-inf, -inf};
+	for(auto& ini : instances) {
+		for(auto v = 0u; v < triangleVertexCount; ++v) {
+			auto pos = transform(ini, v);
+			min = {std::min(min.x, pos.x), std::min(min.y, pos.y)};
+			max = {std::max(max.x, pos.x), std::max(max.y, pos.y)};
+		}
+	}
+
+	auto file = std::fopen(path.c_str(), "wb");
+	if(!file) {
+		dlg_error("writeMesh: could not open '{}'", path);
+		return false;
+	}
+
+	MeshHeader header {};
+	std::memcpy(header.magic, "MESH", 4);
+	header.version = meshVersion;
+	header.vertexCount = vertexCount;
+	header.chunkCount = (vertexCount + chunkVertices - 1) / chunkVertices;
+	header.offset = {0.5f * (min.x + max.x), 0.5f * (min.y + max.y)};
+	header.scale = {
+		std::max(0.5f * (max.x - min.x), 1e-6f),
+		std::max(0.5f * (max.y - min.y), 1e-6f)};
+	auto ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+	// the chunks are written one by one, the baked mesh is never
+	// completely in memory
+	std::vector<PackedVertex> vertices;
+	vertices.reserve(chunkVertices);
+	auto flush = [&](std::uint64_t first) {
+		MeshChunk chunk {};
+		chunk.vertexCount = vertices.size();
+		chunk.firstVertex = first;
+		ok = ok && std::fwrite(&chunk, sizeof(chunk), 1, file) == 1 &&
+			std::fwrite(vertices.data(), sizeof(vertices[0]), vertices.size(),
+				file) == vertices.size();
+		vertices.clear();
+	};
+
+	auto written = std::uint64_t(0);
+	for(auto& ini : instances) {
+		for(auto v = 0u; v < triangleVertexCount && ok; ++v) {
+			auto pos = transform(ini, v);
+
+			PackedVertex vert;
+			vert.position[0] = snorm16((pos.x - header.offset.x) / header.scale.x);
+			vert.position[1] = snorm16((pos.y - header.offset.y) / header.scale.y);
+			vert.color[0] = unorm8(color(ini, v, 0));
+			vert.color[1] = unorm8(color(ini, v, 1));
+			vert.color[2] = unorm8(color(ini, v, 2));
+			vert.color[3] = 255u;
+			vertices.push_back(vert);
+		}
+
+		if(vertices.size() == chunkVertices) {
+			flush(written);
+			written += chunkVertices;
+		}
+	}
+
+	if(!vertices.empty()) {
+		flush(written);
+	}
+
+	ok = std::fclose(file) == 0 && ok;
+	if(!ok) {
+		dlg_error("writeMesh: writing '{}' failed", path);
+		return false;
+	}
+
+	dlg_info("writeMesh: wrote {} triangles in {} chunks to '{}'",
+		vertexCount / 3, header.chunkCount, path);
+	return true;
+}
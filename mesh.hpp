@@ -0,0 +1,93 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <scene.hpp> // SceneSettings
+#include <nytl/vec.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary mesh format: a MeshHeader followed by chunkCount chunks, each a
+// MeshChunk followed by its vertices. The vertices form a triangle list,
+// chunks only contain whole triangles. All fields are little endian.
+// The layout allows to memory map the file and upload the chunks
+// directly from the mapping, see MeshFile.
+
+/// Vertex of a binary mesh, see VertexFormat::packed.
+struct PackedVertex {
+	std::int16_t position[2]; // snorm, relative to the mesh bounds
+	std::uint8_t color[4]; // final rgba unorm, alpha is ignored
+};
+
+struct MeshHeader {
+	char magic[4]; // "MESH"
+	std::uint32_t version; // meshVersion
+	std::uint64_t vertexCount; // of all chunks
+	std::uint32_t chunkCount;
+	std::uint32_t _pad;
+	nytl::Vec2f offset; // center of the bounds
+	nytl::Vec2f scale; // half size of the bounds
+};
+
+struct MeshChunk {
+	std::uint32_t vertexCount; // multiple of 3
+	std::uint32_t _pad;
+	std::uint64_t firstVertex; // index of its first vertex in the mesh
+};
+
+constexpr std::uint32_t meshVersion = 2u; // 2: baked colors
+
+/// Read only view of a mesh file. Memory maps the file (on windows, it is
+/// read into memory instead), so opening even large meshes is cheap and
+/// chunks are only paged in when accessed.
+/// Throws std::runtime_error if the file can't be opened or is invalid.
+class MeshFile {
+public:
+	struct Chunk {
+		const MeshChunk* header;
+		const PackedVertex* vertices;
+	};
+
+public:
+	MeshFile(const std::string& path);
+	~MeshFile();
+
+	MeshFile(const MeshFile&) = delete;
+	MeshFile& operator=(const MeshFile&) = delete;
+
+	const MeshHeader& header() const { return *header_; }
+	const std::vector<Chunk>& chunks() const { return chunks_; }
+	std::uint64_t vertexCount() const { return header_->vertexCount; }
+	std::size_t size() const { return size_; }
+
+protected:
+	void parse(const std::string& path); // validates, fills chunks_
+	void unmap();
+
+protected:
+	const std::uint8_t* data_ {};
+	std::size_t size_ {};
+	const MeshHeader* header_ {};
+	std::vector<Chunk> chunks_;
+	std::vector<std::uint8_t> buffer_; // file content if not mapped
+};
+
+/// Converts count vertices into the given format, writes
+/// count * vertexSize(format) bytes to dst.
+/// The float vertices have the layout of triangleVertices.
+void convertVertices(const PackedVertex*, std::size_t count, VertexFormat,
+	std::uint8_t* dst);
+void convertVertices(const float*, std::size_t count, VertexFormat,
+	std::uint8_t* dst);
+
+/// Bakes the triangles generated for the given settings (see
+/// generateInstances) into a mesh file with chunks of at most
+/// chunkVertices vertices. The instance transforms are applied to the
+/// positions, the colors are blended and tinted like triangle.vert does,
+/// meshes are rendered with the colors as they are.
+/// Returns false if the file could not be written.
+bool writeMesh(const std::string& path, const SceneSettings&,
+	unsigned int chunkVertices = 3 * 64 * 1024);
@@ -0,0 +1,181 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <pipelines.hpp>
+#include <render.hpp> // createRenderPass, createGraphicsPipelines
+
+#include <vpp/util/file.hpp>
+#include <dlg/dlg.hpp> // dlg
+#include <algorithm> // std::remove_if
+#include <chrono>
+#include <fstream> // std::ifstream
+#include <iterator> // std::istreambuf_iterator
+
+// shader data
+#include <shaders/triangle.frag.h>
+#include <shaders/triangle.vert.h>
+
+PipelineStore::PipelineStore(const vpp::Device& dev, vk::ImageLayout finalLayout,
+	std::string cacheFile, const std::vector<std::uint8_t>& cacheData,
+	VertexFormat vertexFormat, bool bakedColors) : device_(&dev),
+		finalLayout_(finalLayout), vertexFormat_(vertexFormat),
+		bakedColors_(bakedColors), cacheFile_(std::move(cacheFile))
+{
+	layout_ = {dev, {}, {}};
+	vertex_ = {dev, triangle_vert_data};
+	fragment_ = {dev, triangle_frag_data};
+
+	// the implementation ignores incompatible cache data
+	if(!cacheData.empty()) {
+		vk::PipelineCacheCreateInfo info;
+		info.initialDataSize = cacheData.size();
+		info.pInitialData = cacheData.data();
+		cache_ = {dev, vk::createPipelineCache(dev, info)};
+	} else if(cacheFile_.empty()) {
+		cache_ = {dev};
+	} else {
+		cache_ = {dev, cacheFile_};
+	}
+}
+
+std::vector<std::uint8_t> PipelineStore::readCacheFile(const std::string& file)
+{
+	std::ifstream in(file, std::ios::binary);
+	if(!in.is_open()) {
+		return {};
+	}
+
+	return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+PipelineStore::~PipelineStore()
+{
+	for(auto& task : tasks_) {
+		task.wait();
+	}
+
+	save();
+}
+
+void PipelineStore::save()
+{
+	if(!cacheFile_.empty()) {
+		vpp::save(cache_, cacheFile_);
+	}
+}
+
+PipelineStore::Slot& PipelineStore::slot(const Key& key)
+{
+	auto& slot = entries_[key];
+	if(!slot) {
+		// the creation is deferred until the first wait on the future,
+		// i.e. it runs on whatever thread needs the entry first
+		slot = std::make_unique<Slot>();
+		auto ptr = slot.get();
+		slot->future = std::async(std::launch::deferred, [this, ptr, key]{
+			create(ptr->entry, key);
+		}).share();
+	}
+
+	return *slot;
+}
+
+const PipelineStore::Entry& PipelineStore::get(vk::Format format,
+	vk::SampleCountBits samples, bool resolve)
+{
+	std::shared_future<void> future;
+	Entry* entry;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto& s = slot(Key {format, samples, resolve});
+		future = s.future;
+		entry = &s.entry;
+	}
+
+	future.get(); // rethrows creation errors
+	return *entry;
+}
+
+void PipelineStore::prewarm(vk::Format format)
+{
+	const vk::SampleCountBits counts[] = {
+		vk::SampleCountBits::e1,
+		vk::SampleCountBits::e2,
+		vk::SampleCountBits::e4,
+		vk::SampleCountBits::e8,
+	};
+
+	auto supported = device().properties().limits.framebufferColorSampleCounts;
+	std::vector<std::shared_future<void>> futures;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	for(auto count : counts) {
+		if(supported & count) {
+			futures.push_back(slot(Key {format, count, true}).future);
+		}
+	}
+
+	launch(std::move(futures));
+}
+
+void PipelineStore::compile(vk::Format format, vk::SampleCountBits samples,
+	bool resolve)
+{
+	using namespace std::chrono_literals;
+
+	// the future is only ready once the deferred creation has finished,
+	// waiting again in the new task is harmless if it is already running
+	// (e.g. in the prewarm task). One task per slot is enough though,
+	// repeated switches must not pile up threads
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto& s = slot(Key {format, samples, resolve});
+	if(!s.launched && s.future.wait_for(0s) != std::future_status::ready) {
+		s.launched = true;
+		launch({s.future});
+	}
+}
+
+void PipelineStore::launch(std::vector<std::shared_future<void>> futures)
+{
+	using namespace std::chrono_literals;
+
+	// drop the finished tasks
+	tasks_.erase(std::remove_if(tasks_.begin(), tasks_.end(), [](auto& task) {
+			return task.wait_for(0s) == std::future_status::ready;
+		}), tasks_.end());
+
+	// waiting on the deferred futures runs the creation on the task thread
+	// (unless another thread already started it)
+	tasks_.push_back(std::async(std::launch::async, [futures = std::move(futures)]{
+		for(auto& future : futures) {
+			future.wait();
+		}
+	}));
+}
+
+bool PipelineStore::ready(vk::Format format, vk::SampleCountBits samples,
+	bool resolve) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = entries_.find(Key {format, samples, resolve});
+	if(it == entries_.end()) {
+		return false;
+	}
+
+	using namespace std::chrono_literals;
+	return it->second->future.wait_for(0s) == std::future_status::ready;
+}
+
+void PipelineStore::create(Entry& entry, const Key& key)
+{
+	auto& dev = device();
+	auto [format, samples, resolve] = key;
+	entry.renderPass = createRenderPass(dev, format, samples, finalLayout_,
+		resolve);
+	auto pipeline = createGraphicsPipelines(dev, entry.renderPass, layout_,
+		samples, cache_, vertex_, fragment_, vertexFormat_, bakedColors_);
+	entry.pipeline = {dev, pipeline};
+	dlg_debug("PipelineStore: created pipeline for {} samples", (int) samples);
+}
@@ -0,0 +1,116 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <vpp/device.hpp> // vpp::Device
+#include <vpp/pipeline.hpp> // vpp::Pipeline
+#include <vpp/shader.hpp> // vpp::ShaderModule
+#include <vpp/handles.hpp>
+#include <vpp/vk.hpp>
+#include <scene.hpp> // VertexFormat
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/// Creates and caches the render passes and graphics pipelines for all
+/// (format, sample count, resolve attachment) combinations that are used.
+/// Keeps the shader modules and the vulkan pipeline cache resident, the
+/// pipeline cache is loaded once at creation and only written back
+/// to disk on destruction.
+/// Pipelines can be pre-compiled on a background thread, see prewarm.
+class PipelineStore {
+public:
+	struct Entry {
+		vpp::RenderPass renderPass;
+		vpp::Pipeline pipeline;
+	};
+
+public:
+	/// The render passes will transition their single sampled color
+	/// attachment into finalLayout.
+	/// cacheFile is the file to load and store the pipeline cache from,
+	/// can be empty to not use a persistent cache.
+	/// If cacheData is not empty, it is used instead of loading cacheFile,
+	/// e.g. when it was already read on another thread, see readCacheFile.
+	/// All pipelines read vertices in the given format, with bakedColors
+	/// they use the vertex colors as they are (see createGraphicsPipelines).
+	PipelineStore(const vpp::Device&, vk::ImageLayout finalLayout,
+		std::string cacheFile = "graphicsCache.bin",
+		const std::vector<std::uint8_t>& cacheData = {},
+		VertexFormat = VertexFormat::float32, bool bakedColors = false);
+	~PipelineStore();
+
+	/// Returns the render pass and pipeline for the given format and
+	/// sample count. Creates them if they are not yet cached, blocks if
+	/// they are currently compiled on the background thread.
+	/// If resolve is false, the render pass has no resolve attachment and
+	/// leaves the multisample image ready for sampling, see createRenderPass.
+	/// Threadsafe.
+	const Entry& get(vk::Format, vk::SampleCountBits, bool resolve = true);
+
+	/// Starts compiling the pipelines for all sample counts the device
+	/// supports for the given format on a background thread.
+	/// Only compiles the variants with resolve attachment.
+	void prewarm(vk::Format);
+
+	/// Starts compiling the pipeline for the given format and sample count
+	/// on a background thread if it is not already compiled or compiling.
+	/// Use ready to check whether it has finished.
+	void compile(vk::Format, vk::SampleCountBits, bool resolve = true);
+
+	/// Returns whether the entry for the given format and sample count
+	/// is compiled and get would therefore not block.
+	bool ready(vk::Format, vk::SampleCountBits, bool resolve = true) const;
+
+	/// Writes the pipeline cache to disk. Automatically called on destruction.
+	void save();
+
+	/// Reads the given pipeline cache file, returns an empty vector
+	/// if it does not exist. Does not need a device.
+	static std::vector<std::uint8_t> readCacheFile(const std::string&);
+
+	vk::PipelineLayout layout() const { return layout_; }
+	/// The vulkan pipeline cache, may be used for other pipelines
+	/// as well so they are persisted with it.
+	vk::PipelineCache cache() const { return cache_; }
+	vk::ImageLayout finalLayout() const { return finalLayout_; }
+	VertexFormat vertexFormat() const { return vertexFormat_; }
+	bool bakedColors() const { return bakedColors_; }
+	const vpp::Device& device() const { return *device_; }
+
+protected:
+	using Key = std::tuple<vk::Format, vk::SampleCountBits, bool>;
+	struct Slot {
+		std::shared_future<void> future; // deferred or already run
+		bool launched {}; // whether compile started a task for it
+		Entry entry;
+	};
+
+	Slot& slot(const Key&); // mutex_ must be locked
+	void create(Entry&, const Key&);
+	void launch(std::vector<std::shared_future<void>>); // mutex_ must be locked
+
+protected:
+	const vpp::Device* device_;
+	vk::ImageLayout finalLayout_;
+	VertexFormat vertexFormat_;
+	bool bakedColors_;
+	std::string cacheFile_;
+
+	vpp::PipelineLayout layout_;
+	vpp::ShaderModule vertex_;
+	vpp::ShaderModule fragment_;
+	vpp::PipelineCache cache_;
+
+	mutable std::mutex mutex_;
+	std::map<Key, std::unique_ptr<Slot>> entries_;
+	std::vector<std::future<void>> tasks_; // background compilations
+};
@@ -0,0 +1,534 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <raster.hpp>
+#include <trace.hpp> // TRACE_SCOPE
+#include <dlg/dlg.hpp> // dlg
+#include <algorithm> // std::min, std::max, std::fill
+#include <atomic>
+#include <cmath> // std::floor, std::ceil, std::round
+#include <cstdio> // std::fopen
+#include <cstring> // std::memcpy
+#include <stdexcept> // std::invalid_argument
+#include <thread>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+namespace {
+
+// subpixel precision of the snapped vertex positions
+constexpr auto subpixels = 256.0;
+
+// opaque black, the clear color of the renderer
+constexpr auto clearColor = 0xFF000000u;
+
+// see resolve.comp
+const nytl::Vec2f locations1[] = {{0.5f, 0.5f}};
+const nytl::Vec2f locations2[] = {{0.75f, 0.75f}, {0.25f, 0.25f}};
+const nytl::Vec2f locations4[] = {
+	{0.375f, 0.125f}, {0.875f, 0.375f},
+	{0.125f, 0.625f}, {0.625f, 0.875f}};
+const nytl::Vec2f locations8[] = {
+	{0.5625f, 0.3125f}, {0.4375f, 0.6875f},
+	{0.8125f, 0.5625f}, {0.3125f, 0.1875f},
+	{0.1875f, 0.8125f}, {0.0625f, 0.4375f},
+	{0.6875f, 0.9375f}, {0.9375f, 0.0625f}};
+
+// Small wrappers for 4 pixel wide vectors so the kernels below are written
+// once. Edge functions are evaluated in double (exact, so the fill rule
+// works), colors in float.
+#ifdef __SSE2__
+
+struct Edge4 {
+	__m128d lo, hi;
+};
+
+struct Float4 {
+	__m128 v;
+};
+
+struct Pixels4 {
+	__m128i v;
+};
+
+// lanes: value + step * {0, 1, 2, 3}
+inline Edge4 ramp(double value, double step)
+{
+	return {_mm_setr_pd(value, value + step),
+		_mm_setr_pd(value + 2 * step, value + 3 * step)};
+}
+
+inline Edge4 operator+(Edge4 a, Edge4 b)
+{
+	return {_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)};
+}
+
+// returns the lanes with a > 0 (or a >= 0 if inclusive) as bitmask
+inline int positive(Edge4 a, bool inclusive)
+{
+	auto zero = _mm_setzero_pd();
+	auto lo = inclusive ? _mm_cmpge_pd(a.lo, zero) : _mm_cmpgt_pd(a.lo, zero);
+	auto hi = inclusive ? _mm_cmpge_pd(a.hi, zero) : _mm_cmpgt_pd(a.hi, zero);
+	return _mm_movemask_pd(lo) | (_mm_movemask_pd(hi) << 2);
+}
+
+inline Float4 toFloat(Edge4 a)
+{
+	return {_mm_movelh_ps(_mm_cvtpd_ps(a.lo), _mm_cvtpd_ps(a.hi))};
+}
+
+inline Float4 splat(float a)
+{
+	return {_mm_set1_ps(a)};
+}
+
+inline Float4 operator+(Float4 a, Float4 b)
+{
+	return {_mm_add_ps(a.v, b.v)};
+}
+
+inline Float4 operator*(Float4 a, Float4 b)
+{
+	return {_mm_mul_ps(a.v, b.v)};
+}
+
+// converts to r8g8b8a8Unorm (clamping, rounding to nearest), alpha is 1
+inline Pixels4 pack(Float4 r, Float4 g, Float4 b)
+{
+	auto unorm = [](Float4 c) {
+		auto v = _mm_min_ps(_mm_max_ps(c.v, _mm_setzero_ps()), _mm_set1_ps(1.f));
+		return _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(255.f)));
+	};
+
+	auto px = _mm_or_si128(unorm(r), _mm_slli_epi32(unorm(g), 8));
+	px = _mm_or_si128(px, _mm_slli_epi32(unorm(b), 16));
+	return {_mm_or_si128(px, _mm_set1_epi32(int(clearColor)))};
+}
+
+// writes the lanes of px selected by mask to dst
+inline void store(std::uint32_t* dst, Pixels4 px, int mask)
+{
+	auto ptr = reinterpret_cast<__m128i*>(dst);
+	if(mask == 0xF) {
+		_mm_storeu_si128(ptr, px.v);
+		return;
+	}
+
+	auto m = _mm_setr_epi32(-(mask & 1), -((mask >> 1) & 1),
+		-((mask >> 2) & 1), -((mask >> 3) & 1));
+	auto old = _mm_loadu_si128(ptr);
+	_mm_storeu_si128(ptr, _mm_or_si128(_mm_and_si128(m, px.v),
+		_mm_andnot_si128(m, old)));
+}
+
+// box filters 4 pixels over count samples (count = 1 << shift), each
+// sample stride words after the previous one. Rounds to nearest.
+inline void resolve(const std::uint32_t* samples, unsigned int stride,
+	unsigned int shift, std::uint32_t* dst)
+{
+	// 8 samples * 255 fit into 16 bit
+	auto zero = _mm_setzero_si128();
+	auto lo = _mm_set1_epi16(short((1 << shift) >> 1));
+	auto hi = lo;
+	for(auto s = 0u; s < (1u << shift); ++s) {
+		auto px = _mm_loadu_si128(
+			reinterpret_cast<const __m128i*>(samples + s * stride));
+		lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(px, zero));
+		hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(px, zero));
+	}
+
+	auto count = _mm_cvtsi32_si128(int(shift));
+	lo = _mm_srl_epi16(lo, count);
+	hi = _mm_srl_epi16(hi, count);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(lo, hi));
+}
+
+#else // __SSE2__
+
+struct Edge4 {
+	double v[4];
+};
+
+struct Float4 {
+	float v[4];
+};
+
+struct Pixels4 {
+	std::uint32_t v[4];
+};
+
+inline Edge4 ramp(double value, double step)
+{
+	return {{value, value + step, value + 2 * step, value + 3 * step}};
+}
+
+inline Edge4 operator+(Edge4 a, Edge4 b)
+{
+	return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+}
+
+inline int positive(Edge4 a, bool inclusive)
+{
+	auto ret = 0;
+	for(auto i = 0u; i < 4; ++i) {
+		ret |= int(inclusive ? a.v[i] >= 0.0 : a.v[i] > 0.0) << i;
+	}
+	return ret;
+}
+
+inline Float4 toFloat(Edge4 a)
+{
+	return {{float(a.v[0]), float(a.v[1]), float(a.v[2]), float(a.v[3])}};
+}
+
+inline Float4 splat(float a)
+{
+	return {{a, a, a, a}};
+}
+
+inline Float4 operator+(Float4 a, Float4 b)
+{
+	return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+}
+
+inline Float4 operator*(Float4 a, Float4 b)
+{
+	return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}};
+}
+
+inline Pixels4 pack(Float4 r, Float4 g, Float4 b)
+{
+	auto unorm = [](float c) {
+		return std::uint32_t(std::nearbyint(std::min(std::max(c, 0.f), 1.f) * 255.f));
+	};
+
+	Pixels4 ret;
+	for(auto i = 0u; i < 4; ++i) {
+		ret.v[i] = unorm(r.v[i]) | (unorm(g.v[i]) << 8) |
+			(unorm(b.v[i]) << 16) | clearColor;
+	}
+	return ret;
+}
+
+inline void store(std::uint32_t* dst, Pixels4 px, int mask)
+{
+	for(auto i = 0u; i < 4; ++i) {
+		if(mask & (1 << i)) {
+			dst[i] = px.v[i];
+		}
+	}
+}
+
+inline void resolve(const std::uint32_t* samples, unsigned int stride,
+	unsigned int shift, std::uint32_t* dst)
+{
+	for(auto i = 0u; i < 4; ++i) {
+		std::uint32_t px = 0u;
+		for(auto c = 0u; c < 32; c += 8) {
+			auto sum = (1u << shift) >> 1;
+			for(auto s = 0u; s < (1u << shift); ++s) {
+				sum += (samples[s * stride + i] >> c) & 0xFFu;
+			}
+			px |= (sum >> shift) << c;
+		}
+		dst[i] = px;
+	}
+}
+
+#endif // __SSE2__
+
+} // anon namespace
+
+const nytl::Vec2f* sampleLocations(vk::SampleCountBits samples)
+{
+	switch(samples) {
+		case vk::SampleCountBits::e1: return locations1;
+		case vk::SampleCountBits::e2: return locations2;
+		case vk::SampleCountBits::e4: return locations4;
+		case vk::SampleCountBits::e8: return locations8;
+		default: throw std::invalid_argument("sampleLocations: invalid sample count");
+	}
+}
+
+// CpuRasterizer
+CpuRasterizer::CpuRasterizer(vk::Extent2D extent, vk::SampleCountBits samples,
+	unsigned int threads) : extent_(extent), samples_(samples), threads_(threads)
+{
+	sampleLocations(samples); // validates the sample count
+	if(!extent.width || !extent.height) {
+		throw std::invalid_argument("CpuRasterizer: invalid extent");
+	}
+
+	if(!threads_) {
+		threads_ = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	tilesX_ = (extent.width + tileSize - 1) / tileSize;
+	tilesY_ = (extent.height + tileSize - 1) / tileSize;
+	bins_.resize(tilesX_ * tilesY_);
+	image_.resize(extent.width * extent.height, clearColor);
+
+	dlg_info("CpuRasterizer: {}x{}, {} samples, {} tiles on {} threads",
+		extent.width, extent.height, unsigned(samples), bins_.size(), threads_);
+}
+
+void CpuRasterizer::render(const float* vertices, unsigned int vertexCount,
+	const std::vector<Instance>& instances)
+{
+	TRACE_SCOPE("cpu render");
+	setup(vertices, vertexCount, instances);
+
+	// tiles are independent, the threads just take the next one
+	std::atomic<unsigned int> next {0u};
+	auto work = [&]{
+		std::vector<std::uint32_t> samples(tileSize * tileSize * unsigned(samples_));
+		for(auto tile = next++; tile < bins_.size(); tile = next++) {
+			rasterize(tile, samples);
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for(auto i = 1u; i < threads_; ++i) {
+		workers.emplace_back(work);
+	}
+
+	work();
+	for(auto& worker : workers) {
+		worker.join();
+	}
+}
+
+void CpuRasterizer::setup(const float* vertices, unsigned int vertexCount,
+	const std::vector<Instance>& instances)
+{
+	TRACE_SCOPE("cpu setup");
+	triangles_.clear();
+	triangles_.reserve(instances.size() * (vertexCount / 3));
+	for(auto& bin : bins_) {
+		bin.clear();
+	}
+
+	auto width = double(extent_.width);
+	auto height = double(extent_.height);
+	const float base[] = {0.7f, 0.5f, 0.f};
+
+	for(auto& ini : instances) {
+		for(auto t = 0u; t + 2 < vertexCount; t += 3) {
+			Triangle tri;
+			double pos[3][2];
+			for(auto v = 0u; v < 3; ++v) {
+				// see triangle.vert
+				auto vert = vertices + (t + v) * 5;
+				auto x = ini.scale.x * vert[0];
+				auto y = ini.scale.y * vert[1];
+				auto& r = ini.rotation;
+				auto ndcX = ini.offset.x + (r.x * x - r.y * y);
+				auto ndcY = ini.offset.y + (r.y * x + r.x * y);
+
+				// viewport transform, snapped to the subpixel grid
+				pos[v][0] = std::round((ndcX + 1.0) * 0.5 * width * subpixels) / subpixels;
+				pos[v][1] = std::round((ndcY + 1.0) * 0.5 * height * subpixels) / subpixels;
+
+				for(auto c = 0u; c < 3; ++c) {
+					tri.color[v][c] = ini.tint * (0.45f * vert[2 + c] + 0.4f * base[c]);
+				}
+			}
+
+			// culling is disabled, bring all triangles into the same winding
+			auto area = (pos[1][0] - pos[0][0]) * (pos[2][1] - pos[0][1]) -
+				(pos[1][1] - pos[0][1]) * (pos[2][0] - pos[0][0]);
+			if(area == 0.0) {
+				continue;
+			} else if(area < 0.0) {
+				std::swap(pos[1], pos[2]);
+				std::swap(tri.color[1], tri.color[2]);
+				area = -area;
+			}
+
+			for(auto i = 0u; i < 3; ++i) {
+				auto& a = pos[(i + 1) % 3];
+				auto& b = pos[(i + 2) % 3];
+				auto dx = b[0] - a[0];
+				auto dy = b[1] - a[1];
+				tri.a[i] = -dy;
+				tri.b[i] = dx;
+				tri.c[i] = dy * a[0] - dx * a[1];
+
+				// with y pointing down, the inside is right of the edges
+				tri.inclusive[i] = (dy == 0.0 && dx > 0.0) || dy < 0.0;
+			}
+
+			tri.invArea = float(1.0 / area);
+
+			// pixels whose samples may be covered, i.e. that overlap the bounds
+			const int size[] = {int(extent_.width), int(extent_.height)};
+			auto empty = false;
+			for(auto d = 0u; d < 2; ++d) {
+				auto min = std::min({pos[0][d], pos[1][d], pos[2][d]});
+				auto max = std::max({pos[0][d], pos[1][d], pos[2][d]});
+				tri.min[d] = std::max(int(std::floor(min)), 0);
+				tri.max[d] = std::min(int(std::ceil(max)) - 1, size[d] - 1);
+				empty |= tri.min[d] > tri.max[d];
+			}
+
+			if(empty) {
+				continue;
+			}
+
+			// bin in draw order, so tiles blend like the gpu would
+			auto id = std::uint32_t(triangles_.size());
+			triangles_.push_back(tri);
+			for(auto y = tri.min[1] / tileSize; y <= tri.max[1] / tileSize; ++y) {
+				for(auto x = tri.min[0] / tileSize; x <= tri.max[0] / tileSize; ++x) {
+					bins_[y * tilesX_ + x].push_back(id);
+				}
+			}
+		}
+	}
+}
+
+void CpuRasterizer::rasterize(unsigned int tile,
+	std::vector<std::uint32_t>& samples)
+{
+	// samples are stored per tile as [sample][y][x]
+	constexpr auto sampleStride = tileSize * tileSize;
+	auto count = unsigned(samples_);
+	auto locations = sampleLocations(samples_);
+	auto tx = int((tile % tilesX_) * tileSize);
+	auto ty = int((tile / tilesX_) * tileSize);
+
+	std::fill(samples.begin(), samples.end(), clearColor);
+	for(auto id : bins_[tile]) {
+		auto& tri = triangles_[id];
+
+		// covered pixels relative to the tile, x aligned for the vectors
+		auto x0 = std::max(tri.min[0] - tx, 0) & ~3;
+		auto x1 = std::min(tri.max[0] - tx, int(tileSize) - 1);
+		auto y0 = std::max(tri.min[1] - ty, 0);
+		auto y1 = std::min(tri.max[1] - ty, int(tileSize) - 1);
+
+		// edge functions at the samples of the first pixels of the first
+		// row. Stepping them is exact as well
+		Edge4 start[8][3];
+		Edge4 stepX[3];
+		Edge4 stepY[3];
+		for(auto i = 0u; i < 3; ++i) {
+			for(auto s = 0u; s < count; ++s) {
+				auto sx = double(tx + x0) + locations[s].x;
+				auto sy = double(ty + y0) + locations[s].y;
+				start[s][i] = ramp(tri.a[i] * sx + tri.b[i] * sy + tri.c[i], tri.a[i]);
+			}
+
+			stepX[i] = ramp(4 * tri.a[i], 0.0);
+			stepY[i] = ramp(tri.b[i], 0.0);
+		}
+
+		for(auto y = y0; y <= y1; ++y) {
+			auto py = double(ty + y);
+			Edge4 edges[8][3];
+			std::memcpy(edges, start, sizeof(edges));
+			for(auto x = x0; x <= x1; x += 4) {
+				auto px = double(tx + x);
+
+				// coverage per sample, only shaded if anything is covered
+				int masks[8];
+				auto any = 0;
+				for(auto s = 0u; s < count; ++s) {
+					auto mask = 0xF;
+					for(auto i = 0u; i < 3; ++i) {
+						mask &= positive(edges[s][i], tri.inclusive[i]);
+						edges[s][i] = edges[s][i] + stepX[i];
+					}
+
+					masks[s] = mask;
+					any |= mask;
+				}
+
+				if(!any) {
+					continue;
+				}
+
+				// interpolate the color at the pixel centers, see triangle.frag
+				Float4 l[3];
+				for(auto i = 0u; i < 3; ++i) {
+					auto e = ramp(tri.a[i] * (px + 0.5) + tri.b[i] * (py + 0.5) +
+						tri.c[i], tri.a[i]);
+					l[i] = toFloat(e) * splat(tri.invArea);
+				}
+
+				Float4 rgb[3];
+				for(auto c = 0u; c < 3; ++c) {
+					rgb[c] = l[0] * splat(tri.color[0][c]) +
+						l[1] * splat(tri.color[1][c]) +
+						l[2] * splat(tri.color[2][c]);
+				}
+
+				auto color = pack(rgb[0], rgb[1], rgb[2]);
+				auto dst = samples.data() + y * tileSize + x;
+				for(auto s = 0u; s < count; ++s) {
+					if(masks[s]) {
+						store(dst + s * sampleStride, color, masks[s]);
+					}
+				}
+			}
+
+			for(auto s = 0u; s < count; ++s) {
+				for(auto i = 0u; i < 3; ++i) {
+					start[s][i] = start[s][i] + stepY[i];
+				}
+			}
+		}
+	}
+
+	// resolve into the image, the tile may extend over the image bounds
+	auto shift = 0u;
+	while((1u << shift) < count) {
+		++shift;
+	}
+
+	auto width = std::min(unsigned(tileSize), extent_.width - tx);
+	auto height = std::min(unsigned(tileSize), extent_.height - ty);
+	std::uint32_t row[tileSize];
+	for(auto y = 0u; y < height; ++y) {
+		for(auto x = 0u; x < width; x += 4) {
+			resolve(samples.data() + y * tileSize + x, sampleStride, shift, row + x);
+		}
+
+		auto dst = image_.data() + (ty + y) * extent_.width + tx;
+		std::memcpy(dst, row, width * sizeof(row[0]));
+	}
+}
+
+bool writePpm(const std::string& path, vk::Extent2D extent,
+	const std::uint32_t* pixels)
+{
+	auto file = std::fopen(path.c_str(), "wb");
+	if(!file) {
+		dlg_error("writePpm: could not open '{}'", path);
+		return false;
+	}
+
+	std::fprintf(file, "P6\n%u %u\n255\n", extent.width, extent.height);
+	std::vector<std::uint8_t> row(extent.width * 3);
+	auto ok = true;
+	for(auto y = 0u; y < extent.height && ok; ++y) {
+		for(auto x = 0u; x < extent.width; ++x) {
+			auto px = pixels[y * extent.width + x];
+			row[3 * x + 0] = px & 0xFFu;
+			row[3 * x + 1] = (px >> 8) & 0xFFu;
+			row[3 * x + 2] = (px >> 16) & 0xFFu;
+		}
+
+		ok = std::fwrite(row.data(), row.size(), 1, file) == 1;
+	}
+
+	std::fclose(file);
+	if(!ok) {
+		dlg_error("writePpm: writing '{}' failed", path);
+	}
+
+	return ok;
+}
@@ -0,0 +1,78 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <scene.hpp> // Instance
+#include <vpp/vk.hpp>
+#include <nytl/vec.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Returns the standard vulkan sample locations (in [0, 1) relative to
+/// the pixel origin) for the given sample count, which must be 1, 2, 4 or 8.
+const nytl::Vec2f* sampleLocations(vk::SampleCountBits);
+
+/// Renders scenes on the cpu like the triangle pipeline does on the gpu,
+/// with multisampling and a box resolve (like ResolveMode::renderPass).
+/// Used as reference to compare the gpu output against and to render
+/// without vulkan at all.
+/// Triangles are binned into tiles that are rasterized by multiple threads,
+/// 4 pixels at once with sse2 (if available).
+/// Coverage uses the standard sample locations and the top-left fill rule
+/// on vertex positions snapped to 8 bits of subpixel precision; the color
+/// is interpolated at the pixel center and written to all covered samples.
+class CpuRasterizer {
+public:
+	static constexpr auto tileSize = 64u;
+
+	/// threads: number of worker threads, 0 for one per cpu core.
+	CpuRasterizer(vk::Extent2D, vk::SampleCountBits, unsigned int threads = 0);
+
+	/// Clears the image and renders the given instances of the triangle
+	/// list in vertices (see triangleVertices for the layout) in order.
+	void render(const float* vertices, unsigned int vertexCount,
+		const std::vector<Instance>& instances);
+
+	/// The resolved image as r8g8b8a8Unorm, rows tightly packed.
+	/// Every pixel is stored as one little-endian word.
+	const std::vector<std::uint32_t>& image() const { return image_; }
+
+	vk::Extent2D extent() const { return extent_; }
+	vk::SampleCountBits samples() const { return samples_; }
+	unsigned int threads() const { return threads_; }
+
+protected:
+	// edge functions and colors of a triangle in framebuffer space
+	struct Triangle {
+		// edge function i (opposite to vertex i): a[i] * x + b[i] * y + c[i]
+		// double is exact for the snapped positions and sample locations
+		double a[3], b[3], c[3];
+		bool inclusive[3]; // top-left edge, samples on it are covered
+		float invArea;
+		float color[3][3]; // per vertex
+		int min[2], max[2]; // covered pixel bounds, inclusive
+	};
+
+	void setup(const float* vertices, unsigned int vertexCount,
+		const std::vector<Instance>&);
+	void rasterize(unsigned int tile, std::vector<std::uint32_t>& samples);
+
+protected:
+	vk::Extent2D extent_;
+	vk::SampleCountBits samples_;
+	unsigned int threads_;
+	unsigned int tilesX_;
+	unsigned int tilesY_;
+
+	std::vector<Triangle> triangles_;
+	std::vector<std::vector<std::uint32_t>> bins_; // triangle ids per tile
+	std::vector<std::uint32_t> image_;
+};
+
+/// Writes a tightly packed r8g8b8a8 image as binary ppm, dropping alpha.
+/// Returns false if the file could not be written.
+bool writePpm(const std::string& path, vk::Extent2D,
+	const std::uint32_t* pixels);
@@ -0,0 +1,250 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <readback.hpp>
+#include <trace.hpp> // TRACE_SCOPE
+#include <dlg/dlg.hpp> // dlg
+#include <cstring> // std::memcpy
+#include <stdexcept> // std::runtime_error
+
+#ifndef _WIN32
+	#include <fcntl.h> // open
+	#include <sys/mman.h> // mmap
+	#include <unistd.h> // ftruncate
+#endif
+
+// FrameReadback
+FrameReadback::FrameReadback(const vpp::Device& dev, vk::Extent2D extent,
+	vk::Format format, unsigned int slots, ReadbackSink sink)
+		: extent_(extent), format_(format), sink_(std::move(sink))
+{
+	if(slots == 0 || !sink_) {
+		throw std::invalid_argument("FrameReadback: invalid slots or sink");
+	}
+
+	size_ = std::size_t(extent.width) * extent.height * 4u;
+
+	vk::BufferCreateInfo info;
+	info.size = size_;
+	info.usage = vk::BufferUsageBits::transferDst;
+
+	// the host reads the whole frame, uncached memory would be slow
+	auto hostBits = vk::MemoryPropertyBits::hostVisible |
+		vk::MemoryPropertyBits::hostCoherent;
+	auto mem = dev.memoryTypeBits(hostBits | vk::MemoryPropertyBits::hostCached);
+	if(!mem) {
+		mem = dev.memoryTypeBits(hostBits);
+	}
+
+	slots_.resize(slots);
+	for(auto& slot : slots_) {
+		slot.buffer = {dev.devMemAllocator(), info, mem};
+		slot.map = slot.buffer.memoryMap(0, size_);
+	}
+
+	thread_ = std::thread([this]{ run(); });
+}
+
+FrameReadback::~FrameReadback()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		exit_ = true;
+	}
+
+	readyCV_.notify_one();
+	thread_.join();
+}
+
+unsigned int FrameReadback::acquire()
+{
+	TRACE_SCOPE("readback acquire");
+	std::unique_lock<std::mutex> lock(mutex_);
+	auto& slot = slots_[next_];
+	if(slot.used) {
+		if(stalls_++ == 0) {
+			dlg_warn("FrameReadback: sink can't keep up, waiting for it");
+		}
+
+		freeCV_.wait(lock, [&]{ return !slot.used; });
+	}
+
+	slot.used = true;
+	auto ret = next_;
+	next_ = (next_ + 1) % slots_.size();
+	return ret;
+}
+
+void FrameReadback::record(vk::CommandBuffer cmdBuf, vk::Image image,
+	unsigned int slot) const
+{
+	vk::BufferImageCopy region;
+	region.imageSubresource = {vk::ImageAspectBits::color, 0, 0, 1};
+	region.imageExtent = {extent_.width, extent_.height, 1};
+	vk::cmdCopyImageToBuffer(cmdBuf, image, vk::ImageLayout::transferSrcOptimal,
+		slots_[slot].buffer, {region});
+
+	vk::BufferMemoryBarrier barrier;
+	barrier.srcAccessMask = vk::AccessBits::transferWrite;
+	barrier.dstAccessMask = vk::AccessBits::hostRead;
+	barrier.srcQueueFamilyIndex = vk::queueFamilyIgnored;
+	barrier.dstQueueFamilyIndex = vk::queueFamilyIgnored;
+	barrier.buffer = slots_[slot].buffer;
+	barrier.size = size_;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::host, {}, {}, {barrier}, {});
+}
+
+void FrameReadback::complete(unsigned int slot, std::uint64_t frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		slots_[slot].frame = frame;
+		ready_.push_back(slot);
+	}
+
+	readyCV_.notify_one();
+}
+
+void FrameReadback::run()
+{
+	TRACE_THREAD_NAME("readback");
+	while(true) {
+		unsigned int id;
+		{
+			// process all completed frames before exiting
+			std::unique_lock<std::mutex> lock(mutex_);
+			readyCV_.wait(lock, [&]{ return exit_ || !ready_.empty(); });
+			if(ready_.empty()) {
+				return;
+			}
+
+			id = ready_.front();
+			ready_.pop_front();
+		}
+
+		// the slot is not touched by the render thread while used
+		auto& slot = slots_[id];
+		{
+			TRACE_SCOPE("readback sink");
+			auto data = static_cast<const std::uint8_t*>(slot.map.ptr());
+			sink_({slot.frame, extent_, format_, data, size_});
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			slot.used = false;
+		}
+
+		freeCV_.notify_one();
+	}
+}
+
+// FrameStream
+FrameStream::FrameStream(std::string path, unsigned int ringSlots)
+	: path_(std::move(path)), ringSlots_(ringSlots)
+{
+#ifdef _WIN32
+	if(ringSlots_) {
+		dlg_warn("FrameStream: ring files not supported, appending frames");
+		ringSlots_ = 0;
+	}
+#else
+	if(ringSlots_) {
+		fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(fd_ < 0) {
+			throw std::runtime_error("FrameStream: could not open " + path_);
+		}
+
+		return;
+	}
+#endif
+
+	file_ = std::fopen(path_.c_str(), "wb");
+	if(!file_) {
+		throw std::runtime_error("FrameStream: could not open " + path_);
+	}
+}
+
+FrameStream::~FrameStream()
+{
+	unmap();
+	if(file_) {
+		std::fclose(file_);
+	}
+
+#ifndef _WIN32
+	if(fd_ >= 0) {
+		::close(fd_);
+	}
+#endif
+
+	dlg_info("FrameStream: wrote {} frames to '{}'", written_, path_);
+}
+
+void FrameStream::write(const ReadbackFrame& frame)
+{
+	FrameHeader header {{'F', 'R', 'A', 'M'}, frame.extent.width,
+		frame.extent.height, static_cast<std::uint32_t>(frame.format),
+		frame.number};
+
+	if(file_) {
+		auto ok = std::fwrite(&header, sizeof(header), 1, file_) == 1 &&
+			std::fwrite(frame.data, frame.size, 1, file_) == 1;
+		if(!ok) {
+			dlg_error("FrameStream: writing frame {} failed", frame.number);
+			return;
+		}
+	} else {
+		// the slot size changes with the frame size (e.g. on resize),
+		// the ring is restarted then
+		auto slotSize = sizeof(header) + frame.size;
+		if(slotSize != slotSize_ && !map(slotSize)) {
+			return;
+		}
+
+		auto dst = ring_ + (frame.number % ringSlots_) * slotSize_;
+		std::memcpy(dst, &header, sizeof(header));
+		std::memcpy(dst + sizeof(header), frame.data, frame.size);
+	}
+
+	++written_;
+}
+
+bool FrameStream::map(std::size_t slotSize)
+{
+	unmap();
+
+#ifndef _WIN32
+	auto size = slotSize * ringSlots_;
+	if(::ftruncate(fd_, 0) != 0 || ::ftruncate(fd_, size) != 0) {
+		dlg_error("FrameStream: resizing '{}' failed", path_);
+		return false;
+	}
+
+	auto ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if(ptr == MAP_FAILED) {
+		dlg_error("FrameStream: mapping '{}' failed", path_);
+		return false;
+	}
+
+	ring_ = static_cast<std::uint8_t*>(ptr);
+	slotSize_ = slotSize;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void FrameStream::unmap()
+{
+#ifndef _WIN32
+	if(ring_) {
+		::munmap(ring_, slotSize_ * ringSlots_);
+	}
+#endif
+
+	ring_ = nullptr;
+	slotSize_ = 0;
+}
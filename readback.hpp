@@ -0,0 +1,130 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <vpp/device.hpp> // vpp::Device
+#include <vpp/buffer.hpp> // vpp::Buffer
+#include <vpp/memoryMap.hpp> // vpp::MemoryMapView
+#include <vpp/vk.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// A frame that was read back from the gpu.
+/// data is only valid during the ReadbackSink call.
+struct ReadbackFrame {
+	std::uint64_t number; // frame number, see Renderer::submittedFrames
+	vk::Extent2D extent;
+	vk::Format format; // tightly packed, 4 bytes per pixel
+	const std::uint8_t* data;
+	std::size_t size;
+};
+
+/// Called for every read back frame on the readback thread, in order.
+using ReadbackSink = std::function<void(const ReadbackFrame&)>;
+
+/// Copies rendered frames into a ring of host visible buffers and hands
+/// them to a sink on a worker thread once their frame has completed.
+/// The render thread only blocks if the sink can't keep up and all
+/// buffers are still in use, frames are never dropped.
+class FrameReadback {
+public:
+	/// slots is the number of buffers, should be larger than the number
+	/// of frames in flight to absorb variance of the sink.
+	FrameReadback(const vpp::Device&, vk::Extent2D, vk::Format,
+		unsigned int slots, ReadbackSink);
+
+	/// Waits until the sink has processed all completed frames.
+	~FrameReadback();
+
+	/// Returns a free buffer slot. Blocks while all slots are used.
+	unsigned int acquire();
+
+	/// Records the copy of the given image (which must be in
+	/// transferSrcOptimal layout) into the buffer of the given slot,
+	/// including the barrier making it visible to the host.
+	void record(vk::CommandBuffer, vk::Image, unsigned int slot) const;
+
+	/// Hands the slot to the worker thread. Must only be called once
+	/// the frame recorded for it has completed.
+	void complete(unsigned int slot, std::uint64_t frame);
+
+	/// Returns how often acquire had to wait for the sink.
+	unsigned int stalls() const { return stalls_; }
+	vk::Extent2D extent() const { return extent_; }
+
+protected:
+	struct Slot {
+		vpp::Buffer buffer;
+		vpp::MemoryMapView map;
+		bool used {}; // acquired and not yet processed by the sink
+		std::uint64_t frame {};
+	};
+
+	void run();
+
+protected:
+	vk::Extent2D extent_;
+	vk::Format format_;
+	std::size_t size_;
+	ReadbackSink sink_;
+	std::vector<Slot> slots_;
+	unsigned int next_ {}; // slot to acquire next, slots are used in order
+	unsigned int stalls_ {};
+
+	std::mutex mutex_;
+	std::condition_variable readyCV_; // slot completed or exit
+	std::condition_variable freeCV_; // slot processed by the sink
+	std::deque<unsigned int> ready_; // completed slots in order
+	bool exit_ {};
+	std::thread thread_;
+};
+
+/// Header written in front of every frame by FrameStream.
+struct FrameHeader {
+	char magic[4]; // "FRAM"
+	std::uint32_t width;
+	std::uint32_t height;
+	std::uint32_t format; // vk::Format
+	std::uint64_t number; // frame number
+};
+
+/// Writes read back frames into a file, each as FrameHeader followed
+/// by the pixels. Meant to be called from a ReadbackSink.
+/// By default frames are appended (raw stream). With ringSlots > 0 the
+/// file is a memory mapped ring of that many frames instead, frame n is
+/// written to slot n % ringSlots, i.e. the file always has the last
+/// frames and a fixed size, even for long runs. Memory mapping is not
+/// implemented on windows, the frames are appended there.
+class FrameStream {
+public:
+	FrameStream(std::string path, unsigned int ringSlots = 0);
+	~FrameStream();
+
+	void write(const ReadbackFrame&);
+
+	std::uint64_t written() const { return written_; }
+
+protected:
+	bool map(std::size_t slotSize);
+	void unmap();
+
+protected:
+	std::string path_;
+	unsigned int ringSlots_;
+	std::uint64_t written_ {};
+
+	std::FILE* file_ {}; // raw stream
+	int fd_ {-1}; // ring
+	std::uint8_t* ring_ {}; // mapped ring file
+	std::size_t slotSize_ {}; // header + frame size
+};
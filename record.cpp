@@ -0,0 +1,144 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <record.hpp>
+#include <trace.hpp> // TRACE_SCOPE
+#include <dlg/dlg.hpp> // dlg
+#include <stdexcept> // std::invalid_argument
+
+RecordPool::RecordPool(const vpp::Device& dev, std::uint32_t queueFamily,
+	unsigned int threads, unsigned int slots) : device_(&dev)
+{
+	if(threads == 0 || slots == 0) {
+		throw std::invalid_argument("RecordPool: threads and slots must not be 0");
+	}
+
+	// create all pools up front, the workers only reset them
+	workers_.resize(threads);
+	for(auto& worker : workers_) {
+		for(auto i = 0u; i < slots; ++i) {
+			worker.pools.emplace_back(dev, queueFamily,
+				vk::CommandPoolCreateBits::transient);
+			worker.buffers.push_back(worker.pools.back().allocate(
+				vk::CommandBufferLevel::secondary));
+		}
+	}
+
+	recorded_.reserve(threads);
+	for(auto i = 0u; i < threads; ++i) {
+		workers_[i].thread = std::thread([this, i]{ run(i); });
+	}
+
+	dlg_info("RecordPool: recording on {} threads", threads);
+}
+
+RecordPool::~RecordPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		exit_ = true;
+	}
+
+	startCV_.notify_all();
+	for(auto& worker : workers_) {
+		worker.thread.join();
+	}
+}
+
+const std::vector<vk::CommandBuffer>& RecordPool::record(unsigned int slot,
+	const vk::CommandBufferInheritanceInfo& inheritance, unsigned int count,
+	const RecordFunc& func)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		slot_ = slot;
+		count_ = count;
+		inheritance_ = &inheritance;
+		func_ = &func;
+		remaining_ = workers_.size();
+		error_ = {};
+		++job_;
+	}
+
+	startCV_.notify_all();
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	doneCV_.wait(lock, [&]{ return remaining_ == 0; });
+	if(error_) {
+		std::rethrow_exception(error_);
+	}
+
+	recorded_.clear();
+	for(auto& worker : workers_) {
+		recorded_.push_back(worker.buffers[slot]);
+	}
+
+	return recorded_;
+}
+
+void RecordPool::run(unsigned int id)
+{
+	auto& worker = workers_[id];
+	auto job = std::uint64_t {};
+	TRACE_THREAD_NAME("record worker " + std::to_string(id));
+
+	while(true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			startCV_.wait(lock, [&]{ return exit_ || job_ != job; });
+			if(exit_) {
+				return;
+			}
+
+			job = job_;
+		}
+
+		// a failed job must still be completed, otherwise record would
+		// wait forever. The first error is rethrown there
+		std::exception_ptr error;
+		try {
+			work(worker);
+		} catch(...) {
+			error = std::current_exception();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if(error && !error_) {
+				error_ = error;
+			}
+
+			--remaining_;
+		}
+
+		doneCV_.notify_one();
+	}
+}
+
+void RecordPool::work(Worker& worker)
+{
+	TRACE_SCOPE("record secondary");
+	// the job parameters are not changed until all workers are done
+	auto id = static_cast<unsigned int>(&worker - workers_.data());
+	auto threads = static_cast<unsigned int>(workers_.size());
+	auto first = count_ * id / threads;
+	auto end = count_ * (id + 1) / threads;
+
+	// resetting the whole pool is cheaper than resetting the buffer
+	worker.pools[slot_].reset({});
+
+	vk::CommandBuffer cmdBuf = worker.buffers[slot_];
+	vk::CommandBufferBeginInfo beginInfo;
+	beginInfo.flags = vk::CommandBufferUsageBits::oneTimeSubmit |
+		vk::CommandBufferUsageBits::renderPassContinue;
+	beginInfo.pInheritanceInfo = inheritance_;
+	vk::beginCommandBuffer(cmdBuf, beginInfo);
+
+	// an empty range still results in a valid (empty) command buffer
+	if(end > first) {
+		(*func_)(cmdBuf, first, end - first);
+	}
+
+	vk::endCommandBuffer(cmdBuf);
+}
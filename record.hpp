@@ -0,0 +1,77 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <vpp/device.hpp> // vpp::Device
+#include <vpp/commandBuffer.hpp> // vpp::CommandPool, vpp::CommandBuffer
+#include <vpp/vk.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception> // std::exception_ptr
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Pool of worker threads that record secondary command buffers.
+/// Every worker owns one command pool per frame slot (i.e. per frame in
+/// flight) that is reset every time the slot is recorded again, so the
+/// previous submission of a slot must have completed before it is reused.
+class RecordPool {
+public:
+	/// Records the draws [first, first + count) into the given secondary
+	/// command buffer. Called on the worker threads, must be threadsafe.
+	using RecordFunc = std::function<void(vk::CommandBuffer,
+		unsigned int first, unsigned int count)>;
+
+public:
+	RecordPool(const vpp::Device&, std::uint32_t queueFamily,
+		unsigned int threads, unsigned int slots);
+	~RecordPool();
+
+	/// Splits the draws [0, count) into one contiguous range per worker and
+	/// records them in parallel into secondary command buffers that continue
+	/// the render pass described by the inheritance info.
+	/// Blocks until all workers have finished. Returns the recorded command
+	/// buffers in draw order, ready for vkCmdExecuteCommands. They stay
+	/// valid until the slot is recorded again.
+	/// If recording threw on a worker, the first exception is rethrown.
+	const std::vector<vk::CommandBuffer>& record(unsigned int slot,
+		const vk::CommandBufferInheritanceInfo&, unsigned int count,
+		const RecordFunc&);
+
+	unsigned int threads() const { return workers_.size(); }
+	const vpp::Device& device() const { return *device_; }
+
+protected:
+	struct Worker {
+		std::thread thread;
+		std::vector<vpp::CommandPool> pools; // per slot
+		std::vector<vpp::CommandBuffer> buffers; // per slot
+	};
+
+	void run(unsigned int id);
+	void work(Worker&);
+
+protected:
+	const vpp::Device* device_;
+	std::vector<Worker> workers_;
+	std::vector<vk::CommandBuffer> recorded_;
+
+	// the current job, guarded by mutex_
+	std::mutex mutex_;
+	std::condition_variable startCV_;
+	std::condition_variable doneCV_;
+	std::uint64_t job_ {}; // increased for every job
+	unsigned int remaining_ {}; // workers that have not finished the job
+	std::exception_ptr error_; // first exception of the job
+	bool exit_ {};
+
+	unsigned int slot_ {};
+	unsigned int count_ {};
+	const vk::CommandBufferInheritanceInfo* inheritance_ {};
+	const RecordFunc* func_ {};
+};
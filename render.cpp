@@ -4,61 +4,244 @@
 
 #include <render.hpp>
 #include <engine.hpp>
+#include <mesh.hpp> // PackedVertex
+#include <trace.hpp> // TRACE_SCOPE
 
 #include <nytl/mat.hpp>
 #include <vpp/vk.hpp>
-#include <vpp/util/file.hpp>
 #include <vpp/swapchain.hpp>
 
 #include <dlg/dlg.hpp> // dlg
+#include <stdexcept> // std::invalid_argument
+#include <algorithm> // std::remove_if
+#include <cstddef> // offsetof
+#include <cmath> // std::ceil
+#include <cstring> // std::strcmp
+#include <chrono>
 
-// shader data
-#include <shaders/triangle.frag.h>
-#include <shaders/triangle.vert.h>
-
-vk::Pipeline createGraphicsPipelines(const vpp::Device&, vk::RenderPass,
-	vk::PipelineLayout, vk::SampleCountBits);
-vpp::RenderPass createRenderPass(const vpp::Device&, vk::Format,
-	vk::SampleCountBits);
+using Clock = std::chrono::high_resolution_clock;
+using msf = std::chrono::duration<float, std::milli>;
 
 Renderer::Renderer(const vpp::Device& dev, vk::SurfaceKHR surface,
-	vk::SampleCountBits samples, const vpp::Queue& present)
+	const vpp::Queue& queue, const RendererSettings& settings,
+	const vpp::Queue* transfer) :
+		device_(&dev), queue_(&queue), surface_(surface),
+		// with dynamic resolution, the render passes render into the
+		// intermediate target that is blitted to the render buffer
+		pipelines_(dev, (surface && !settings.dynamicResolution) ?
+			vk::ImageLayout::presentSrcKHR :
+			vk::ImageLayout::transferSrcOptimal,
+			settings.pipelineCache, settings.pipelineCacheData,
+			vertexFormat(settings.scene), !settings.scene.mesh.empty())
 {
-	// FIXME: size
+	startup_.end("pipeline store");
+
+	if(settings.framesInFlight == 0) {
+		throw std::invalid_argument("Renderer: framesInFlight must not be 0");
+	}
+
+	auto size = settings.size;
+
+	// target info
+	// in headless mode we only use the format and extent fields of scInfo_
+	if(headless()) {
+		scInfo_.imageFormat = offscreenFormat;
+		scInfo_.imageExtent = {size.x, size.y};
+	} else {
+		scInfo_ = vpp::swapchainCreateInfo(dev, surface, {size.x, size.y});
+		requestedPresentMode_ = settings.presentMode;
+		requestedImageCount_ = settings.imageCount;
+		choosePresentMode();
+	}
+
+	// compute resolve
+	// writes an rgba8 storage image that is blitted to the render target,
+	// see SampleTargets::resolveTarget
+	auto phdev = dev.vkPhysicalDevice();
+	auto features = vk::getPhysicalDeviceFormatProperties(phdev,
+		scInfo_.imageFormat).optimalTilingFeatures;
+	auto storageFeatures = vk::getPhysicalDeviceFormatProperties(phdev,
+		ComputeResolve::storageFormat).optimalTilingFeatures;
+	auto storage = vk::FormatFeatureBits::storageImage |
+		vk::FormatFeatureBits::blitSrc;
+	auto computeResolve = (storageFeatures & storage) == storage &&
+		(features & vk::FormatFeatureBits::blitDst);
+	if(computeResolve && !headless()) {
+		auto caps = vk::getPhysicalDeviceSurfaceCapabilitiesKHR(phdev, surface);
+		computeResolve = bool(caps.supportedUsageFlags &
+			vk::ImageUsageBits::transferDst);
+	}
+
+	if(computeResolve) {
+		computeResolve_ = std::make_unique<ComputeResolve>(dev,
+			pipelines_.cache());
+		scInfo_.imageUsage |= vk::ImageUsageBits::transferDst;
+	} else if(compute(settings.resolve)) {
+		dlg_warn("Renderer: compute resolve not supported, using render pass");
+	}
+
+	resolveMode_ = settings.resolve;
+	pendingResolve_ = settings.resolve;
+
+	// dynamic resolution
+	// the intermediate target is upscaled with a linear blit
+	dynamicResolution_ = settings.dynamicResolution;
+	if(dynamicResolution_) {
+		auto blit = vk::FormatFeatureBits::blitSrc |
+			vk::FormatFeatureBits::blitDst |
+			vk::FormatFeatureBits::sampledImageFilterLinear;
+		auto supported = (features & blit) == blit;
+		if(supported && !headless()) {
+			auto caps = vk::getPhysicalDeviceSurfaceCapabilitiesKHR(phdev, surface);
+			supported = bool(caps.supportedUsageFlags &
+				vk::ImageUsageBits::transferDst);
+		}
+
+		if(!supported) {
+			throw std::runtime_error("Renderer: dynamic resolution not supported");
+		}
+
+		scInfo_.imageUsage |= vk::ImageUsageBits::transferDst;
+		renderScale(settings.renderScale);
+		renderScale_ = pendingScale_;
+	}
+
+	// readback
+	// the offscreen images always support it
+	readbackSink_ = settings.readback;
+	readbackSlots_ = settings.framesInFlight + settings.readbackSlots;
+	if(readbackSink_ && !headless()) {
+		auto caps = vk::getPhysicalDeviceSurfaceCapabilitiesKHR(phdev, surface);
+		if(!(caps.supportedUsageFlags & vk::ImageUsageBits::transferSrc)) {
+			throw std::runtime_error("Renderer: readback not supported");
+		}
+
+		scInfo_.imageUsage |= vk::ImageUsageBits::transferSrc;
+	}
+
 	// pipeline
-	sampleCount_ = samples;
-	scInfo_ = vpp::swapchainCreateInfo(dev, surface, {800u, 500u});
-
-	graphicsLayout_ = {dev, {}, {}};
-	renderPass_ = createRenderPass(dev, scInfo_.imageFormat, samples);
-
-	// buffer
-	vk::BufferCreateInfo bufInfo;
-	bufInfo.usage = vk::BufferUsageBits::vertexBuffer;
-	bufInfo.size = sizeof(float) * 3 * 5;
-	auto mem = dev.memoryTypeBits(vk::MemoryPropertyBits::hostVisible);
-	vertexBuffer_ = {dev.devMemAllocator(), bufInfo, mem};
-
-	// fill it
-	float data[] = {
-		// pos	  // color
-		-.8f, .5f,  0.5f, 0.8f, 0.5f,
-		.8f, .5f,   0.2f, 0.5f, 0.5f,
-		0.f, -.5f,   0.5f, 0.5f, 0.3f
-	};
+	// compile the one we need first on a background thread while
+	// uploading the scene and creating the swapchain, then the others
+	auto resolveInCompute = computeTargets(settings.samples, settings.resolve);
+	pipelines_.compile(scInfo_.imageFormat, settings.samples, !resolveInCompute);
+	pendingSamples_ = settings.samples;
+	if(settings.prewarmPipelines) {
+		pipelines_.prewarm(scInfo_.imageFormat);
+	}
+
+	startup_.end("surface and compute resolve setup");
+
+	// scene
+	// the static data is uploaded once, we wait for it here since the
+	// first frame needs it anyways
+	uploader_ = std::make_unique<Uploader>(dev, transfer ? *transfer : queue,
+		queue);
+	scene_ = std::make_unique<Scene>(dev, *uploader_, settings.scene,
+		settings.instances);
+	uploader_->wait();
+	startup_.end("scene upload");
+
+	// animated instance data is written every frame
+	// one more slot than frames in flight so the ring never runs full
+	if(scene_->animated()) {
+		auto size = (settings.framesInFlight + 1) *
+			(scene_->instanceDataSize() + 16u);
+		ring_ = std::make_unique<RingBuffer>(dev,
+			vk::BufferUsageBits::vertexBuffer, size);
+	}
+
+	startTime_ = std::chrono::steady_clock::now();
+
+	// queries
+	// timestamps are only supported if the queue has valid timestamp bits
+	timestamps_ = settings.timestamps;
+	if(timestamps_ && queue.properties().timestampValidBits == 0) {
+		dlg_warn("Renderer: queue does not support timestamps");
+		timestamps_ = false;
+	}
 
-	juto mmap = vertexBuffer_.memoryMap(0, vk::wholeSize);
-	std::memcpy(mmap.ptr(), data, sizeof(float) * 3 * 5);
+	timestampPeriod_ = dev.properties().limits.timestampPeriod;
+	pipelineStatistics_ = settings.pipelineStatistics;
 
-	auto pipeline = createGraphicsPipelines(dev, renderPass_,
-		graphicsLayout_, sampleCount_);
-	trianglePipeline_ = {dev, pipeline};
+	// the statistics query would have to be active while executing the
+	// secondary command buffers, requiring the inheritedQueries feature
+	if(pipelineStatistics_ && settings.recordThreads > 0) {
+		dlg_warn("Renderer: pipeline statistics not supported with record threads");
+		pipelineStatistics_ = false;
+	}
+
+	vk::QueryPoolCreateInfo queryInfo;
+	if(pipelineStatistics_) {
+		queryInfo.queryType = vk::QueryType::pipelineStatistics;
+		queryInfo.queryCount = 1;
+		queryInfo.pipelineStatistics =
+			vk::QueryPipelineStatisticBits::inputAssemblyVertices |
+			vk::QueryPipelineStatisticBits::vertexShaderInvocations |
+			vk::QueryPipelineStatisticBits::clippingPrimitives |
+			vk::QueryPipelineStatisticBits::fragmentShaderInvocations;
+	}
+
+	// frame resources
+	frames_.resize(settings.framesInFlight);
+	for(auto& frame : frames_) {
+		frame.commandBuffer = dev.commandAllocator().get(queue.family(),
+			vk::CommandPoolCreateBits::resetCommandBuffer);
+		frame.fence = {dev};
+		frame.acquireSemaphore = {dev};
+		frame.renderSemaphore = {dev};
+
+		if(timestamps_) {
+			vk::QueryPoolCreateInfo info;
+			info.queryType = vk::QueryType::timestamp;
+			info.queryCount = queryTimestampCount;
+			frame.timestampPool = {dev, info};
+		}
+
+		if(pipelineStatistics_) {
+			frame.statisticsPool = {dev, queryInfo};
+		}
+	}
+
+	if(settings.recordThreads > 0) {
+		recordPool_ = std::make_unique<RecordPool>(dev, queue.family(),
+			settings.recordThreads, frames_.size());
+	}
 
-	// init renderer
-	vpp::DefaultRenderer::init(renderPass_, scInfo_, present);
+	startup_.end("frame resources");
+
+	// render targets
+	if(!headless()) {
+		swapchain_ = {dev, scInfo_};
+		startup_.end("swapchain");
+	}
+
+	auto& entry = pipelines_.get(scInfo_.imageFormat, settings.samples,
+		!resolveInCompute);
+	targets_ = std::make_unique<SampleTargets>();
+	targets_->samples = settings.samples;
+	targets_->computeResolve = resolveInCompute;
+	targets_->renderPass = entry.renderPass;
+	targets_->pipeline = entry.pipeline;
+	startup_.end("pipeline wait");
+
+	createBuffers();
+	startup_.end("render targets");
+	if(!headless()) {
+		dlg_info("Renderer: {} present mode, {} images, latency up to {} frames",
+			name(scInfo_.presentMode), renderBuffers_.size(), presentLatency());
+	}
 }
 
-void Renderer::createMultisampleTarget(const vk::Extent2D& size)
+Renderer::~Renderer()
+{
+	// completes the pending readbacks
+	wait();
+	vk::deviceWaitIdle(device());
+}
+
+vpp::ViewableImage Renderer::createMultisampleTarget(
+	const vk::Extent2D& size, vk::SampleCountBits samples, bool sampled,
+	bool& lazy)
 {
 	auto width = size.width;
 	auto height = size.height;
@@ -74,9 +257,12 @@ void Renderer::createMultisampleTarget(const vk::Extent2D& size)
 	img.arrayLayers = 1;
 	img.sharingMode = vk::SharingMode::exclusive;
 	img.tiling = vk::ImageTiling::optimal;
-	img.samples = sampleCount_;
+	img.samples = samples;
 	img.usage = vk::ImageUsageBits::transientAttachment | vk::ImageUsageBits::colorAttachment;
 	img.initialLayout = vk::ImageLayout::undefined;
+	if(sampled) {
+		img.usage = vk::ImageUsageBits::sampled | vk::ImageUsageBits::colorAttachment;
+	}
 
 	// view
 	vk::ImageViewCreateInfo view;
@@ -90,81 +276,1005 @@ void Renderer::createMultisampleTarget(const vk::Extent2D& size)
 	view.subresourceRange.levelCount = 1;
 	view.subresourceRange.layerCount = 1;
 
+	// the multisample target is never loaded or stored, so on tiling gpus
+	// it may live only in tile memory. Lazily allocated memory allows the
+	// driver to never actually back it. Not every device offers it.
+	// When it is resolved in a compute shader, it has to be stored though.
+	auto mem = device().memoryTypeBits(vk::MemoryPropertyBits::lazilyAllocated);
+	lazy = mem != 0 && !sampled;
+	if(!lazy) {
+		mem = device().memoryTypeBits(vk::MemoryPropertyBits::deviceLocal);
+	}
+
 	// create the viewable image
 	// will set the created image in the view info for us
-	multisampleTarget_ = {device(), img, view};
+	return {device(), img, view, mem};
 }
 
-void Renderer::record(const RenderBuffer& buf)
+std::unique_ptr<Renderer::SampleTargets> Renderer::createTargets(
+	vk::SampleCountBits samples, bool computeResolve,
+	const PipelineStore::Entry& entry, const SampleTargets* reuse)
 {
+	// we don't keep multisample targets that are more than this
+	// factor larger than needed
+	constexpr auto maxOversize = 4u;
+
+	const auto& size = scInfo_.imageExtent;
+	auto targets = std::make_unique<SampleTargets>();
+	targets->samples = samples;
+	targets->computeResolve = computeResolve;
+	targets->renderPass = entry.renderPass;
+	targets->pipeline = entry.pipeline;
+	targets->extent = size;
+
+	// framebuffer attachments may be larger than the framebuffer, so
+	// we can reuse a multisample target that is large enough.
+	// This avoids reallocations for every size while interactively
+	// resizing
+	// single sampled targets need an offscreen image for post processing
+	auto offscreen = samples != vk::SampleCountBits::e1 || computeResolve;
+	if(offscreen && reuse && reuse->samples == samples &&
+			reuse->computeResolve == computeResolve && reuse->multisampleTarget) {
+		auto& ext = reuse->multisampleExtent;
+		auto area = std::uint64_t(size.width) * size.height;
+		auto oldArea = std::uint64_t(ext.width) * ext.height;
+		if(ext.width >= size.width && ext.height >= size.height &&
+				oldArea <= maxOversize * area) {
+			targets->multisampleTarget = reuse->multisampleTarget;
+			targets->multisampleExtent = ext;
+			targets->multisampleLazy = reuse->multisampleLazy;
+		}
+	}
+
+	if(offscreen && !targets->multisampleTarget) {
+		targets->multisampleTarget = std::make_shared<vpp::ViewableImage>(
+			createMultisampleTarget(size, samples, computeResolve,
+				targets->multisampleLazy));
+		targets->multisampleExtent = size;
+	}
+
+	// always allocated at full size, see renderScale.
+	// The compute resolve upscales from its resolve target instead
+	if(dynamicResolution_ && !computeResolve) {
+		vk::ImageCreateInfo img;
+		img.imageType = vk::ImageType::e2d;
+		img.format = scInfo_.imageFormat;
+		img.extent = {size.width, size.height, 1};
+		img.mipLevels = 1;
+		img.arrayLayers = 1;
+		img.sharingMode = vk::SharingMode::exclusive;
+		img.tiling = vk::ImageTiling::optimal;
+		img.samples = vk::SampleCountBits::e1;
+		img.usage = vk::ImageUsageBits::colorAttachment |
+			vk::ImageUsageBits::transferSrc;
+		img.initialLayout = vk::ImageLayout::undefined;
+
+		vk::ImageViewCreateInfo view;
+		view.viewType = vk::ImageViewType::e2d;
+		view.format = img.format;
+		view.components.r = vk::ComponentSwizzle::r;
+		view.components.g = vk::ComponentSwizzle::g;
+		view.components.b = vk::ComponentSwizzle::b;
+		view.components.a = vk::ComponentSwizzle::a;
+		view.subresourceRange.aspectMask = vk::ImageAspectBits::color;
+		view.subresourceRange.levelCount = 1;
+		view.subresourceRange.layerCount = 1;
+
+		auto mem = device().memoryTypeBits(vk::MemoryPropertyBits::deviceLocal);
+		targets->upscaleTarget = {device(), img, view, mem};
+	}
+
+	for(auto& buf : renderBuffers_) {
+		std::vector<vk::ImageView> attachments;
+		if(offscreen) {
+			attachments.push_back(targets->multisampleTarget->vkImageView());
+		}
+
+		if(!computeResolve) {
+			attachments.push_back(dynamicResolution_ ?
+				targets->upscaleTarget.vkImageView() : buf.imageView);
+		}
+
+		vk::FramebufferCreateInfo fbInfo;
+		fbInfo.renderPass = entry.renderPass;
+		fbInfo.attachmentCount = attachments.size();
+		fbInfo.pAttachments = attachments.data();
+		fbInfo.width = size.width;
+		fbInfo.height = size.height;
+		fbInfo.layers = 1;
+		targets->framebuffers.emplace_back(device(), fbInfo);
+	}
+
+	// the storage image the compute resolve writes, at full size like
+	// the upscale target
+	if(computeResolve) {
+		vk::ImageCreateInfo img;
+		img.imageType = vk::ImageType::e2d;
+		img.format = ComputeResolve::storageFormat;
+		img.extent = {size.width, size.height, 1};
+		img.mipLevels = 1;
+		img.arrayLayers = 1;
+		img.sharingMode = vk::SharingMode::exclusive;
+		img.tiling = vk::ImageTiling::optimal;
+		img.samples = vk::SampleCountBits::e1;
+		img.usage = vk::ImageUsageBits::storage |
+			vk::ImageUsageBits::transferSrc;
+		img.initialLayout = vk::ImageLayout::undefined;
+
+		vk::ImageViewCreateInfo view;
+		view.viewType = vk::ImageViewType::e2d;
+		view.format = img.format;
+		view.components.r = vk::ComponentSwizzle::r;
+		view.components.g = vk::ComponentSwizzle::g;
+		view.components.b = vk::ComponentSwizzle::b;
+		view.components.a = vk::ComponentSwizzle::a;
+		view.subresourceRange.aspectMask = vk::ImageAspectBits::color;
+		view.subresourceRange.levelCount = 1;
+		view.subresourceRange.layerCount = 1;
+
+		auto mem = device().memoryTypeBits(vk::MemoryPropertyBits::deviceLocal);
+		targets->resolveTarget = {device(), img, view, mem};
+
+		vk::DescriptorPoolSize sizes[2] = {
+			{vk::DescriptorType::combinedImageSampler, 1},
+			{vk::DescriptorType::storageImage, 1},
+		};
+
+		vk::DescriptorPoolCreateInfo poolInfo;
+		poolInfo.maxSets = 1;
+		poolInfo.poolSizeCount = 2;
+		poolInfo.pPoolSizes = sizes;
+		targets->resolvePool = {device(), poolInfo};
+
+		auto layout = computeResolve_->descriptorLayout();
+		vk::DescriptorSetAllocateInfo allocInfo;
+		allocInfo.descriptorPool = targets->resolvePool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &layout;
+		vk::allocateDescriptorSets(device(), allocInfo, targets->resolveSet);
+		computeResolve_->write(targets->resolveSet,
+			targets->multisampleTarget->vkImageView(),
+			targets->resolveTarget.vkImageView());
+	}
+
+	return targets;
+}
+
+std::unique_ptr<Renderer::SampleTargets> Renderer::createBuffers()
+{
+	const auto& size = scInfo_.imageExtent;
+
+	// target images
+	std::vector<vk::Image> images;
+	if(headless()) {
+		// one offscreen image per frame in flight, they are used
+		// in the same order as the frames
+		images.resize(frames_.size());
+	} else {
+		images = vk::getSwapchainImagesKHR(device(), swapchain_);
+	}
+
+	renderBuffers_.resize(images.size());
+	for(auto i = 0u; i < images.size(); ++i) {
+		auto& buf = renderBuffers_[i];
+		if(headless()) {
+			vk::ImageCreateInfo img;
+			img.imageType = vk::ImageType::e2d;
+			img.format = scInfo_.imageFormat;
+			img.extent = {size.width, size.height, 1};
+			img.mipLevels = 1;
+			img.arrayLayers = 1;
+			img.sharingMode = vk::SharingMode::exclusive;
+			img.tiling = vk::ImageTiling::optimal;
+			img.samples = vk::SampleCountBits::e1;
+			img.usage = vk::ImageUsageBits::colorAttachment |
+				vk::ImageUsageBits::transferSrc;
+			img.initialLayout = vk::ImageLayout::undefined;
+			if(computeResolve_ || dynamicResolution_) {
+				img.usage |= vk::ImageUsageBits::transferDst;
+			}
+
+			auto mem = device().memoryTypeBits(vk::MemoryPropertyBits::deviceLocal);
+			buf.offscreen = {device(), img, mem};
+			buf.image = buf.offscreen;
+		} else {
+			buf.image = images[i];
+		}
+
+		vk::ImageViewCreateInfo view;
+		view.image = buf.image;
+		view.viewType = vk::ImageViewType::e2d;
+		view.format = scInfo_.imageFormat;
+		view.components.r = vk::ComponentSwizzle::r;
+		view.components.g = vk::ComponentSwizzle::g;
+		view.components.b = vk::ComponentSwizzle::b;
+		view.components.a = vk::ComponentSwizzle::a;
+		view.subresourceRange.aspectMask = vk::ImageAspectBits::color;
+		view.subresourceRange.levelCount = 1;
+		view.subresourceRange.layerCount = 1;
+		buf.imageView = {device(), view};
+	}
+
+	// the render pass and pipeline are already known, they don't
+	// depend on the size
+	auto old = std::move(targets_);
+	auto& entry = pipelines_.get(scInfo_.imageFormat, old->samples,
+		!old->computeResolve);
+	targets_ = createTargets(old->samples, old->computeResolve, entry, old.get());
+
+	// the previous one (if any) was retired by applyResize
+	if(readbackSink_ && !readback_) {
+		readback_ = std::make_unique<FrameReadback>(device(), size,
+			scInfo_.imageFormat, readbackSlots_, readbackSink_);
+	}
+
+	return old;
+}
+
+void Renderer::record(const Frame& frame, unsigned int buffer)
+{
+	TRACE_SCOPE("record");
 	static const auto clearValue = vk::ClearValue {{0.f, 0.f, 0.f, 1.f}};
-	const auto width = scInfo_.imageExtent.width;
-	const auto height = scInfo_.imageExtent.height;
+	const auto extent = renderExtent();
+	const auto width = extent.width;
+	const auto height = extent.height;
 
-	auto cmdBuf = buf.commandBuffer;
+	vk::CommandBuffer cmdBuf = frame.commandBuffer;
 	vk::beginCommandBuffer(cmdBuf, {});
+
+	if(timestamps_) {
+		vk::cmdResetQueryPool(cmdBuf, frame.timestampPool, 0, queryTimestampCount);
+		vk::cmdWriteTimestamp(cmdBuf, vk::PipelineStageBits::topOfPipe,
+			frame.timestampPool, timestampBegin);
+	}
+
+	if(pipelineStatistics_) {
+		vk::cmdResetQueryPool(cmdBuf, frame.statisticsPool, 0, 1);
+	}
+
+	auto contents = recordPool_ ?
+		vk::SubpassContents::secondaryCommandBuffers :
+		vk::SubpassContents::eInline;
 	vk::cmdBeginRenderPass(cmdBuf, {
-		renderPass(),
-		buf.framebuffer,
+		targets_->renderPass,
+		targets_->framebuffers[buffer],
 		{0u, 0u, width, height},
 		1,
 		&clearValue
-	}, {});
+	}, contents);
+
+	if(recordPool_) {
+		// the workers record into secondary buffers of this frame slot,
+		// which has completed since we waited for its fence
+		vk::CommandBufferInheritanceInfo inheritance;
+		inheritance.renderPass = targets_->renderPass;
+		inheritance.subpass = 0;
+		inheritance.framebuffer = targets_->framebuffers[buffer];
+
+		auto slot = static_cast<unsigned int>(&frame - frames_.data());
+		auto& cmdBufs = recordPool_->record(slot, inheritance,
+			scene_->drawCount(), [&](vk::CommandBuffer secondary,
+				unsigned int first, unsigned int count) {
+					recordDraws(secondary, first, count);
+				});
+		vk::cmdExecuteCommands(cmdBuf, cmdBufs);
+	} else {
+		if(pipelineStatistics_) {
+			vk::cmdBeginQuery(cmdBuf, frame.statisticsPool, 0, {});
+		}
+
+		recordDraws(cmdBuf, 0, scene_->drawCount());
+
+		if(pipelineStatistics_) {
+			vk::cmdEndQuery(cmdBuf, frame.statisticsPool, 0);
+		}
+	}
+
+	// the multisample resolve happens at the end of the subpass (or in
+	// the compute pass after it), i.e. between this timestamp and the
+	// one after the resolve. Therefore timestampEnd - timestampDraw is
+	// the resolve cost (plus the store ops)
+	if(timestamps_) {
+		vk::cmdWriteTimestamp(cmdBuf, vk::PipelineStageBits::bottomOfPipe,
+			frame.timestampPool, timestampDraw);
+	}
+
+	vk::cmdEndRenderPass(cmdBuf);
+
+	if(targets_->computeResolve) {
+		recordResolve(cmdBuf);
+		recordBlit(cmdBuf, buffer, targets_->resolveTarget.image());
+	} else if(dynamicResolution_) {
+		recordBlit(cmdBuf, buffer, targets_->upscaleTarget.image());
+	}
+
+	if(timestamps_) {
+		vk::cmdWriteTimestamp(cmdBuf, vk::PipelineStageBits::bottomOfPipe,
+			frame.timestampPool, timestampEnd);
+	}
+
+	// not included in the gpu frame time
+	if(frame.readback) {
+		recordReadback(frame, buffer);
+	}
+
+	vk::endCommandBuffer(cmdBuf);
+}
+
+void Renderer::recordReadback(const Frame& frame, unsigned int buffer)
+{
+	// the target might have been written by the render pass or a blit
+	vk::CommandBuffer cmdBuf = frame.commandBuffer;
+	auto layout = finalLayout();
+	vk::ImageMemoryBarrier barrier;
+	barrier.image = renderBuffers_[buffer].image;
+	barrier.oldLayout = layout;
+	barrier.newLayout = vk::ImageLayout::transferSrcOptimal;
+	barrier.srcAccessMask = vk::AccessBits::colorAttachmentWrite |
+		vk::AccessBits::transferWrite;
+	barrier.dstAccessMask = vk::AccessBits::transferRead;
+	barrier.srcQueueFamilyIndex = vk::queueFamilyIgnored;
+	barrier.dstQueueFamilyIndex = vk::queueFamilyIgnored;
+	barrier.subresourceRange = {vk::ImageAspectBits::color, 0, 1, 0, 1};
+	vk::cmdPipelineBarrier(cmdBuf,
+		vk::PipelineStageBits::colorAttachmentOutput |
+			vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::transfer, {}, {}, {}, {barrier});
+
+	frame.readback->record(cmdBuf, barrier.image, frame.readbackSlot);
+
+	if(layout != vk::ImageLayout::transferSrcOptimal) {
+		barrier.oldLayout = vk::ImageLayout::transferSrcOptimal;
+		barrier.newLayout = layout;
+		barrier.srcAccessMask = {};
+		barrier.dstAccessMask = vk::AccessBits::memoryRead;
+		vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::transfer,
+			vk::PipelineStageBits::bottomOfPipe, {}, {}, {}, {barrier});
+	}
+}
+
+void Renderer::recordResolve(vk::CommandBuffer cmdBuf)
+{
+	// the render pass already made the multisample image available
+	// to the compute shader, we only have to transition the resolve
+	// target, which was read by the blit of the previous frame
+	vk::ImageMemoryBarrier barrier;
+	barrier.image = targets_->resolveTarget.image();
+	barrier.oldLayout = vk::ImageLayout::undefined;
+	barrier.newLayout = vk::ImageLayout::general;
+	barrier.dstAccessMask = vk::AccessBits::shaderWrite;
+	barrier.srcQueueFamilyIndex = vk::queueFamilyIgnored;
+	barrier.dstQueueFamilyIndex = vk::queueFamilyIgnored;
+	barrier.subresourceRange = {vk::ImageAspectBits::color, 0, 1, 0, 1};
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::computeShader, {}, {}, {}, {barrier});
+
+	computeResolve_->record(cmdBuf, resolveMode_, targets_->resolveSet,
+		targets_->samples, renderExtent());
+
+	barrier.oldLayout = vk::ImageLayout::general;
+	barrier.newLayout = vk::ImageLayout::transferSrcOptimal;
+	barrier.srcAccessMask = vk::AccessBits::shaderWrite;
+	barrier.dstAccessMask = vk::AccessBits::transferRead;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::computeShader,
+		vk::PipelineStageBits::transfer, {}, {}, {}, {barrier});
+}
 
+void Renderer::recordBlit(vk::CommandBuffer cmdBuf, unsigned int buffer,
+	vk::Image src)
+{
+	// the source is already in transferSrcOptimal, made available by
+	// the render pass or the compute resolve. The blit also converts
+	// from the rgba8 resolve target to the format of the render buffer.
+	// The transfer stage is part of the acquire semaphore wait stages
+	auto& image = renderBuffers_[buffer].image;
+	vk::ImageMemoryBarrier barrier;
+	barrier.image = image;
+	barrier.oldLayout = vk::ImageLayout::undefined;
+	barrier.newLayout = vk::ImageLayout::transferDstOptimal;
+	barrier.dstAccessMask = vk::AccessBits::transferWrite;
+	barrier.srcQueueFamilyIndex = vk::queueFamilyIgnored;
+	barrier.dstQueueFamilyIndex = vk::queueFamilyIgnored;
+	barrier.subresourceRange = {vk::ImageAspectBits::color, 0, 1, 0, 1};
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::transfer, {}, {}, {}, {barrier});
+
+	auto srcExtent = renderExtent();
+	auto& dst = scInfo_.imageExtent;
+	vk::ImageBlit blit;
+	blit.srcSubresource = {vk::ImageAspectBits::color, 0, 0, 1};
+	blit.srcOffsets[1] = {int(srcExtent.width), int(srcExtent.height), 1};
+	blit.dstSubresource = {vk::ImageAspectBits::color, 0, 0, 1};
+	blit.dstOffsets[1] = {int(dst.width), int(dst.height), 1};
+	vk::cmdBlitImage(cmdBuf, src,
+		vk::ImageLayout::transferSrcOptimal, image,
+		vk::ImageLayout::transferDstOptimal, {blit}, vk::Filter::linear);
+
+	barrier.oldLayout = vk::ImageLayout::transferDstOptimal;
+	barrier.newLayout = finalLayout();
+	barrier.srcAccessMask = vk::AccessBits::transferWrite;
+	barrier.dstAccessMask = vk::AccessBits::memoryRead;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::bottomOfPipe, {}, {}, {}, {barrier});
+}
+
+vk::ImageLayout Renderer::finalLayout() const
+{
+	return headless() ?
+		vk::ImageLayout::transferSrcOptimal :
+		vk::ImageLayout::presentSrcKHR;
+}
+
+void Renderer::renderScale(float scale)
+{
+	if(!dynamicResolution_) {
+		dlg_warn("Renderer: dynamic resolution not enabled");
+		return;
+	}
+
+	pendingScale_ = std::clamp(scale, minRenderScale, 1.f);
+}
+
+vk::Extent2D Renderer::renderExtent() const
+{
+	auto& ext = scInfo_.imageExtent;
+	if(!dynamicResolution_) {
+		return ext;
+	}
+
+	return {
+		std::max(1u, unsigned(std::ceil(ext.width * renderScale_))),
+		std::max(1u, unsigned(std::ceil(ext.height * renderScale_)))};
+}
+
+void Renderer::recordDraws(vk::CommandBuffer cmdBuf, unsigned int first,
+	unsigned int count)
+{
+	// dynamic state is not inherited by secondary command buffers
+	const auto extent = renderExtent();
+	const auto width = extent.width;
+	const auto height = extent.height;
 	vk::Viewport vp {0.f, 0.f, (float) width, (float) height, 0.f, 1.f};
 	vk::cmdSetViewport(cmdBuf, 0, 1, vp);
 	vk::cmdSetScissor(cmdBuf, 0, 1, {0, 0, width, height});
 
-	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::graphics, trianglePipeline_);
-	vk::cmdBindVertexBuffers(cmdBuf, 0, {vertexBuffer_}, {0});
-	vk::cmdDraw(cmdBuf, 3, 1, 0, 0);
+	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::graphics,
+		targets_->pipeline);
+	scene_->record(cmdBuf, first, count);
+}
 
-	vk::cmdEndRenderPass(cmdBuf);
-	vk::endCommandBuffer(cmdBuf);
+void Renderer::render()
+{
+	TRACE_SCOPE("render");
+	auto& frame = frames_[frameIndex_];
+	waitFrame(frame);
+	auto start = Clock::now();
+
+	// includes the waits, i.e. the actual frame rate
+	auto frameStart = std::chrono::steady_clock::now();
+	if(lastFrameStart_ != std::chrono::steady_clock::time_point {}) {
+		frameIntervals_.add(msf(frameStart - lastFrameStart_).count());
+	}
+
+	lastFrameStart_ = frameStart;
+
+	// frame boundary: the only place where targets are switched
+	destroyRetired();
+	applyResize();
+	applySamples();
+	renderScale_ = pendingScale_;
+
+	damaged_ = false;
+
+	// per-frame data
+	scene_->stream(*uploader_);
+	if(ring_) {
+		ring_->reclaim(completedFrames_);
+		auto time = std::chrono::duration<float>(
+			std::chrono::steady_clock::now() - startTime_).count();
+		scene_->update(*ring_, frameNumber_, time);
+	}
+
+	// acquire the target
+	unsigned int id;
+	if(headless()) {
+		id = frameIndex_;
+	} else {
+		TRACE_SCOPE("acquire");
+		auto res = swapchain_.acquire(id, frame.acquireSemaphore);
+		if(res == vk::Result::errorOutOfDateKHR) {
+			dlg_info("render: acquire returned out of date");
+			if(!resizePending_) {
+				resize({scInfo_.imageExtent.width, scInfo_.imageExtent.height});
+			}
+
+			return;
+		}
+	}
+
+	// blocks only if the readback sink can't keep up
+	if(readback_) {
+		frame.readback = readback_.get();
+		frame.readbackSlot = readback_->acquire();
+	}
+
+	record(frame, id);
+
+	// submit
+	vk::CommandBuffer cmdBuf = frame.commandBuffer;
+	vk::Semaphore waitSemaphore = frame.acquireSemaphore;
+	vk::Semaphore signalSemaphore = frame.renderSemaphore;
+	vk::PipelineStageFlags waitStage = vk::PipelineStageBits::colorAttachmentOutput;
+	if(targets_->computeResolve || dynamicResolution_) {
+		waitStage |= vk::PipelineStageBits::transfer;
+	}
+
+	vk::SubmitInfo submitInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &cmdBuf;
+	if(!headless()) {
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &waitSemaphore;
+		submitInfo.pWaitDstStageMask = &waitStage;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &signalSemaphore;
+	}
+
+	{
+		TRACE_SCOPE("submit");
+		frame.submitTime = traceNow();
+		vk::resetFences(device(), {frame.fence});
+		vk::queueSubmit(queue_->vkHandle(), {submitInfo}, frame.fence);
+	}
+
+	frame.pending = true;
+	frame.number = frameNumber_++;
+	frameIndex_ = (frameIndex_ + 1) % frames_.size();
+
+	// present
+	if(!headless()) {
+		TRACE_SCOPE("present");
+		auto res = swapchain_.present(*queue_, id, frame.renderSemaphore);
+		if(res == vk::Result::errorOutOfDateKHR) {
+			dlg_info("render: present returned out of date");
+			damaged_ = true;
+		}
+	}
+
+	cpuTimes_.add(msf(Clock::now() - start).count());
+}
+
+void Renderer::renderStall()
+{
+	render();
+	wait();
+}
+
+bool Renderer::redrawNeeded() const
+{
+	// pending switches are applied as soon as the pipeline is ready,
+	// we have to keep rendering until then
+	return damaged_ || resizePending_ || scene_->animated() ||
+		scene_->streaming() ||
+		pendingSamples_ != targets_->samples ||
+		pendingResolve_ != resolveMode_ ||
+		pendingScale_ != renderScale_;
+}
+
+void Renderer::wait()
+{
+	for(auto& frame : frames_) {
+		waitFrame(frame);
+	}
+}
+
+void Renderer::waitFrame(Frame& frame)
+{
+	if(frame.pending) {
+		TRACE_SCOPE("wait frame");
+		vk::waitForFences(device(), {frame.fence}, true, UINT64_MAX);
+		frame.pending = false;
+		completedFrames_ = std::max(completedFrames_, frame.number + 1);
+		readQueries(frame);
+
+		if(frame.readback) {
+			frame.readback->complete(frame.readbackSlot, frame.number);
+			frame.readback = nullptr;
+		}
+	}
+}
+
+void Renderer::readQueries(Frame& frame)
+{
+	// the frame has completed so all results are available and
+	// querying them does not stall
+	if(timestamps_) {
+		std::uint64_t stamps[queryTimestampCount];
+		auto res = vk::getQueryPoolResults(device(), frame.timestampPool, 0,
+			queryTimestampCount, sizeof(stamps), stamps, sizeof(stamps[0]),
+			vk::QueryResultBits::e64);
+		if(res == vk::Result::success) {
+			auto toMs = timestampPeriod_ / (1000.f * 1000.f);
+			lastGpuTime_ = (stamps[timestampEnd] - stamps[timestampBegin]) * toMs;
+			gpuTimes_.add(lastGpuTime_);
+			resolveTimes_.add((stamps[timestampEnd] - stamps[timestampDraw]) * toMs);
+
+#ifdef ENABLE_TRACE
+			// there is no common clock for cpu and gpu timestamps. A frame
+			// can't start on the gpu before it was submitted, so we use the
+			// smallest offset for which this holds for all frames so far
+			if(traceEnabled()) {
+				auto ns = [&](unsigned int i) {
+					return std::int64_t(double(stamps[i]) * timestampPeriod_);
+				};
+
+				gpuTraceOffset_ = std::max(gpuTraceOffset_,
+					std::int64_t(frame.submitTime) - ns(timestampBegin));
+				auto begin = ns(timestampBegin) + gpuTraceOffset_;
+				auto draw = ns(timestampDraw) + gpuTraceOffset_;
+				auto end = ns(timestampEnd) + gpuTraceOffset_;
+				traceSpan("gpu frame", begin, end - begin, true);
+				traceSpan("draws", begin, draw - begin, true);
+				traceSpan("resolve", draw, end - draw, true);
+			}
+#endif
+		}
+	}
+
+	if(pipelineStatistics_) {
+		// results are written in the order of the statistic bits
+		std::uint64_t stats[4];
+		auto res = vk::getQueryPoolResults(device(), frame.statisticsPool, 0, 1,
+			sizeof(stats), stats, sizeof(stats), vk::QueryResultBits::e64);
+		if(res == vk::Result::success) {
+			pipelineStats_.inputAssemblyVertices = stats[0];
+			pipelineStats_.vertexShaderInvocations = stats[1];
+			pipelineStats_.clippingPrimitives = stats[2];
+			pipelineStats_.fragmentShaderInvocations = stats[3];
+		}
+	}
+}
+
+FrameStats Renderer::frameStats() const
+{
+	FrameStats ret;
+	ret.cpu = cpuTimes_.summary();
+	ret.gpu = gpuTimes_.summary();
+	ret.resolve = resolveTimes_.summary();
+	ret.interval = frameIntervals_.summary();
+	return ret;
+}
+
+MemoryReport Renderer::memoryReport() const
+{
+	MemoryReport report {};
+	auto add = [&](std::string name, vk::Image image, bool lazy,
+			vk::DeviceMemory memory) {
+		MemoryReport::Entry entry {std::move(name), 0u, lazy, 0u, true};
+		entry.size = vk::getImageMemoryRequirements(device(), image).size;
+		entry.committed = entry.size;
+		if(lazy) {
+			entry.committed = vk::getDeviceMemoryCommitment(device(), memory);
+		}
+
+		report.total += entry.committed;
+		report.entries.push_back(std::move(entry));
+	};
+
+	if(targets_->multisampleTarget) {
+		auto& img = targets_->multisampleTarget->image();
+		auto label = targets_->samples == vk::SampleCountBits::e1 ?
+			"post-process target" : "multisample target";
+		add(label, img, targets_->multisampleLazy,
+			img.memoryEntry().memory()->vkHandle());
+	}
+
+	if(targets_->computeResolve) {
+		add("resolve target", targets_->resolveTarget.image(), false, {});
+	} else if(dynamicResolution_) {
+		add("upscale target", targets_->upscaleTarget.image(), false, {});
+	}
+
+	if(headless()) {
+		for(auto i = 0u; i < renderBuffers_.size(); ++i) {
+			auto& img = renderBuffers_[i].offscreen;
+			add("offscreen image " + std::to_string(i), img, false, {});
+		}
+	} else {
+		// swapchain images are owned by the driver, we can only estimate
+		// (assuming 4 bytes per pixel)
+		auto& ext = scInfo_.imageExtent;
+		MemoryReport::Entry entry {"swapchain images", 0u, false, 0u, false};
+		entry.size = vk::DeviceSize(ext.width) * ext.height * 4u *
+			renderBuffers_.size();
+		entry.committed = entry.size;
+		report.total += entry.size;
+		report.entries.push_back(std::move(entry));
+	}
+
+	auto addBuffer = [&](std::string name, vk::Buffer buf) {
+		if(!buf) {
+			return;
+		}
+
+		auto size = vk::getBufferMemoryRequirements(device(), buf).size;
+		report.entries.push_back({std::move(name), size, false, size, true});
+		report.total += size;
+	};
+
+	addBuffer("vertex buffer", scene_->vertexBuffer());
+	addBuffer("instance buffer", scene_->instanceBuffer());
+	addBuffer("indirect buffer", scene_->indirectBuffer());
+	if(ring_) {
+		addBuffer("instance ring buffer", ring_->buffer());
+	}
+
+	return report;
+}
+
+void Renderer::resetFrameStats()
+{
+	cpuTimes_.reset();
+	gpuTimes_.reset();
+	resolveTimes_.reset();
+	frameIntervals_.reset();
+}
+
+unsigned int Renderer::queueDepth() const
+{
+	auto count = 0u;
+	for(auto& frame : frames_) {
+		if(frame.pending &&
+				vk::getFenceStatus(device(), frame.fence) == vk::Result::notReady) {
+			++count;
+		}
+	}
+
+	return count;
 }
 
 void Renderer::resize(nytl::Vec2ui size)
 {
-	vpp::DefaultRenderer::recreate({size.x, size.y}, scInfo_);
+	TRACE_SCOPE("resize");
+	pendingSize_ = size;
+	resizePending_ = true;
+}
+
+void Renderer::applyResize()
+{
+	// minimized windows can't have a swapchain, keep the resize pending
+	if(!resizePending_ || pendingSize_.x == 0 || pendingSize_.y == 0) {
+		return;
+	}
+
+	resizePending_ = false;
+	TRACE_SCOPE("apply resize");
+
+	// all frames submitted until now may still use the old resources
+	Retired retired;
+	retired.lastFrame = frameNumber_;
+	retired.renderBuffers = std::move(renderBuffers_);
+	retired.readback = std::move(readback_);
+	renderBuffers_.clear();
+
+	if(headless()) {
+		scInfo_.imageExtent = {pendingSize_.x, pendingSize_.y};
+	} else {
+		// the surface might dictate the size
+		auto phdev = device().vkPhysicalDevice();
+		auto caps = vk::getPhysicalDeviceSurfaceCapabilitiesKHR(phdev, surface_);
+		if(caps.currentExtent.width == 0xFFFFFFFF) {
+			scInfo_.imageExtent.width = std::clamp(pendingSize_.x,
+				caps.minImageExtent.width, caps.maxImageExtent.width);
+			scInfo_.imageExtent.height = std::clamp(pendingSize_.y,
+				caps.minImageExtent.height, caps.maxImageExtent.height);
+		} else {
+			scInfo_.imageExtent = caps.currentExtent;
+		}
+
+		choosePresentMode();
+
+		// chain the old swapchain so the driver can reuse its resources
+		// and pending presents of it are still valid
+		scInfo_.oldSwapchain = swapchain_;
+		vpp::Swapchain swapchain {device(), scInfo_};
+		scInfo_.oldSwapchain = {};
+
+		retired.swapchain = std::move(swapchain_);
+		swapchain_ = std::move(swapchain);
+	}
+
+	// will reuse the multisample target if possible
+	retired.targets = createBuffers();
+	retired_.push_back(std::move(retired));
+
+	auto& ext = scInfo_.imageExtent;
+	dlg_info("Renderer: resized to {}x{}", ext.width, ext.height);
+	if(!headless()) {
+		dlg_info("Renderer: {} present mode, {} images, latency up to {} frames",
+			name(scInfo_.presentMode), renderBuffers_.size(), presentLatency());
+	}
+}
+
+void Renderer::presentMode(vk::PresentModeKHR mode, unsigned int imageCount)
+{
+	if(headless()) {
+		dlg_warn("Renderer: present mode has no effect in headless mode");
+		return;
+	}
+
+	requestedPresentMode_ = mode;
+	requestedImageCount_ = imageCount;
+
+	// recreating the swapchain is done by applyResize
+	if(!resizePending_) {
+		resize({scInfo_.imageExtent.width, scInfo_.imageExtent.height});
+	}
+}
+
+void Renderer::choosePresentMode()
+{
+	auto phdev = device().vkPhysicalDevice();
+	auto modes = vk::getPhysicalDeviceSurfacePresentModesKHR(phdev, surface_);
+	auto supported = [&](vk::PresentModeKHR mode) {
+		return std::find(modes.begin(), modes.end(), mode) != modes.end();
+	};
+
+	// fifo is always supported. For immediate, mailbox is the closer
+	// fallback since it is not capped to the refresh rate either
+	auto mode = requestedPresentMode_;
+	if(!supported(mode)) {
+		auto fallback = vk::PresentModeKHR::fifo;
+		if(mode == vk::PresentModeKHR::immediate &&
+				supported(vk::PresentModeKHR::mailbox)) {
+			fallback = vk::PresentModeKHR::mailbox;
+		}
+
+		dlg_warn("Renderer: {} present mode not supported, using {}",
+			name(mode), name(fallback));
+		mode = fallback;
+	}
+
+	// maxImageCount is 0 if there is no limit
+	auto caps = vk::getPhysicalDeviceSurfaceCapabilitiesKHR(phdev, surface_);
+	auto max = caps.maxImageCount ? caps.maxImageCount : UINT32_MAX;
+	auto count = requestedImageCount_;
+	if(count == 0) {
+		count = std::min(caps.minImageCount + 1, max);
+	} else if(count < caps.minImageCount || count > max) {
+		auto clamped = std::clamp(count, caps.minImageCount, max);
+		dlg_warn("Renderer: {} swapchain images not supported, using {}",
+			count, clamped);
+		count = clamped;
+	}
+
+	scInfo_.presentMode = mode;
+	scInfo_.minImageCount = count;
+}
+
+unsigned int Renderer::presentLatency() const
+{
+	if(headless()) {
+		return frames_.size();
+	}
+
+	// one image is always presented, the others can be queued.
+	// The frame currently rendered adds one
+	auto mode = scInfo_.presentMode;
+	if(mode == vk::PresentModeKHR::fifo ||
+			mode == vk::PresentModeKHR::fifoRelaxed) {
+		return renderBuffers_.size();
+	}
+
+	return 1u;
+}
+
+const char* name(vk::PresentModeKHR mode)
+{
+	switch(mode) {
+		case vk::PresentModeKHR::fifo: return "fifo";
+		case vk::PresentModeKHR::fifoRelaxed: return "fifo-relaxed";
+		case vk::PresentModeKHR::mailbox: return "mailbox";
+		case vk::PresentModeKHR::immediate: return "immediate";
+		default: return "<unknown>";
+	}
+}
+
+bool parsePresentMode(const char* str, vk::PresentModeKHR& mode)
+{
+	for(auto m : {vk::PresentModeKHR::fifo, vk::PresentModeKHR::fifoRelaxed,
+			vk::PresentModeKHR::mailbox, vk::PresentModeKHR::immediate}) {
+		if(!std::strcmp(str, name(m))) {
+			mode = m;
+			return true;
+		}
+	}
+
+	return false;
 }
 
 void Renderer::samples(vk::SampleCountBits samples)
 {
-	sampleCount_ = samples;
-	if(sampleCount_ != vk::SampleCountBits::e1) {
-		createMultisampleTarget(scInfo_.imageExtent);
+	TRACE_SCOPE("samples");
+	pendingSamples_ = samples;
+	pipelines_.compile(scInfo_.imageFormat, samples,
+		!computeTargets(pendingSamples_, pendingResolve_));
+}
+
+void Renderer::resolve(ResolveMode mode)
+{
+	if(compute(mode) && !computeResolve_) {
+		dlg_warn("Renderer: compute resolve not supported, using render pass");
 	}
 
-	renderPass_ = createRenderPass(device(), scInfo_.imageFormat, samples);
-	vpp::DefaultRenderer::renderPass_ = renderPass_;
-	auto pipeline = createGraphicsPipelines(device(), renderPass_,
-		graphicsLayout_, sampleCount_);
-	trianglePipeline_ = {device(), pipeline};
+	pendingResolve_ = mode;
+	pipelines_.compile(scInfo_.imageFormat, pendingSamples_,
+		!computeTargets(pendingSamples_, pendingResolve_));
+}
 
-	initBuffers(scInfo_.imageExtent, renderBuffers_);
-	invalidate();
+bool Renderer::computeTargets(vk::SampleCountBits samples,
+	ResolveMode mode) const
+{
+	// post-process anti aliasing works on the single sampled image
+	if(mode == ResolveMode::fxaa) {
+		return computeResolve_ && samples == vk::SampleCountBits::e1;
+	}
+
+	// the multisample image must be sampleable with that count
+	auto& limits = device().properties().limits;
+	return computeResolve_ && compute(mode) &&
+		samples != vk::SampleCountBits::e1 &&
+		(limits.sampledImageColorSampleCounts & samples);
 }
 
-void Renderer::initBuffers(const vk::Extent2D& size,
-	nytl::Span<RenderBuffer> bufs)
+void Renderer::applySamples()
 {
-	if(sampleCount_ != vk::SampleCountBits::e1) {
-		createMultisampleTarget(scInfo_.imageExtent);
-		vpp::DefaultRenderer::initBuffers(size, bufs,
-			{multisampleTarget_.vkImageView()});
-	} else {
-		vpp::DefaultRenderer::initBuffers(size, bufs, {});
+	auto format = scInfo_.imageFormat;
+	auto computeResolve = computeTargets(pendingSamples_, pendingResolve_);
+	if(pendingSamples_ == targets_->samples &&
+			computeResolve == targets_->computeResolve) {
+		// switching between compute filters needs no new targets
+		resolveMode_ = pendingResolve_;
+		return;
 	}
+
+	if(!pipelines_.ready(format, pendingSamples_, !computeResolve)) {
+		return;
+	}
+
+	// all frames submitted until now may still use the old targets
+	TRACE_SCOPE("apply samples");
+	auto& entry = pipelines_.get(format, pendingSamples_, !computeResolve);
+	auto targets = createTargets(pendingSamples_, computeResolve, entry);
+
+	Retired retired;
+	retired.targets = std::move(targets_);
+	retired.lastFrame = frameNumber_;
+	retired_.push_back(std::move(retired));
+
+	targets_ = std::move(targets);
+	resolveMode_ = pendingResolve_;
+	dlg_info("Renderer: switched to {} samples, {} resolve",
+		(int) targets_->samples, name(resolveMode_));
+}
+
+void Renderer::destroyRetired()
+{
+	auto it = std::remove_if(retired_.begin(), retired_.end(),
+		[&](const auto& retired) {
+			return retired.lastFrame <= completedFrames_;
+		});
+	retired_.erase(it, retired_.end());
 }
 
 // utility
 vk::Pipeline createGraphicsPipelines(const vpp::Device& device,
-	vk::RenderPass renderPass, vk::PipelineLayout layout, vk::SampleCountBits sampleCount)
+	vk::RenderPass renderPass, vk::PipelineLayout layout,
+	vk::SampleCountBits sampleCount, vk::PipelineCache cache,
+	vk::ShaderModule lightVertex, vk::ShaderModule lightFragment,
+	VertexFormat vertexFormat, bool bakedColors)
 {
 	// auto msaa = sampleCount != vk::SampleCountBits::e1;
-	auto lightVertex = vpp::ShaderModule(device, triangle_vert_data);
-	auto lightFragment = vpp::ShaderModule(device, triangle_frag_data);
-
 	vpp::ShaderProgram lightStages({
 		{lightVertex, vk::ShaderStageBits::vertex},
 		{lightFragment, vk::ShaderStageBits::fragment}
@@ -175,27 +1285,60 @@ vk::Pipeline createGraphicsPipelines(const vpp::Device& device,
 	trianglePipe.renderPass = renderPass;
 	trianglePipe.layout = layout;
 
-	trianglePipe.stageCount = lightStages.vkStageInfos().size();
-	trianglePipe.pStages = lightStages.vkStageInfos().data();
+	// the vertex stage comes first
+	vk::Bool32 baked = bakedColors;
+	vk::SpecializationMapEntry bakedEntry {0u, 0u, sizeof(baked)};
+	vk::SpecializationInfo spec;
+	spec.mapEntryCount = 1;
+	spec.pMapEntries = &bakedEntry;
+	spec.dataSize = sizeof(baked);
+	spec.pData = &baked;
 
-	constexpr auto stride = sizeof(float) * 5; // vec2 pos, vec3 color
-	vk::VertexInputBindingDescription bufferBinding {0, stride, vk::VertexInputRate::vertex};
+	auto stages = lightStages.vkStageInfos();
+	stages[0].pSpecializationInfo = &spec;
+	trianglePipe.stageCount = stages.size();
+	trianglePipe.pStages = stages.data();
 
-	// vertex position attribute
-	vk::VertexInputAttributeDescription attributes[2];
+	// vertex attributes
+	// the shader reads the packed formats as floats as well, the
+	// alpha of rgba8 colors is ignored
+	vk::VertexInputAttributeDescription attributes[4];
+	auto stride = std::uint32_t(vertexSize(vertexFormat));
 	attributes[0].format = vk::Format::r32g32Sfloat; // pos
 	attributes[1].format = vk::Format::r32g32b32Sfloat; // color
 	attributes[1].location = 1;
+	attributes[1].offset = sizeof(float) * 2;
+	if(vertexFormat != VertexFormat::float32) {
+		// half has the layout of PackedVertex, only the position differs
+		attributes[0].format = (vertexFormat == VertexFormat::half) ?
+			vk::Format::r16g16Sfloat : vk::Format::r16g16Snorm;
+		attributes[1].format = vk::Format::r8g8b8a8Unorm;
+		attributes[1].offset = offsetof(PackedVertex, color);
+	}
+
+	vk::VertexInputBindingDescription bufferBindings[2];
+	bufferBindings[0] = {0, stride, vk::VertexInputRate::vertex};
+	bufferBindings[1] = {1, sizeof(Instance), vk::VertexInputRate::instance};
+
+	// instance attributes
+	attributes[2].format = vk::Format::r32g32b32a32Sfloat; // offset, scale
+	attributes[2].location = 2;
+	attributes[2].binding = 1;
+	attributes[2].offset = offsetof(Instance, offset);
+	attributes[3].format = vk::Format::r32g32b32Sfloat; // rotation, tint
+	attributes[3].location = 3;
+	attributes[3].binding = 1;
+	attributes[3].offset = offsetof(Instance, rotation);
 
 	vk::PipelineVertexInputStateCreateInfo vertexInfo;
-	vertexInfo.vertexBindingDescriptionCount = 1;
-	vertexInfo.pVertexBindingDescriptions = &bufferBinding;
-	vertexInfo.vertexAttributeDescriptionCount = 2;
+	vertexInfo.vertexBindingDescriptionCount = 2;
+	vertexInfo.pVertexBindingDescriptions = bufferBindings;
+	vertexInfo.vertexAttributeDescriptionCount = 4;
 	vertexInfo.pVertexAttributeDescriptions = attributes;
 	trianglePipe.pVertexInputState = &vertexInfo;
 
 	vk::PipelineInputAssemblyStateCreateInfo assemblyInfo;
-	assemblyInfo.topology = vk::PrimitiveTopology::triangleFan;
+	assemblyInfo.topology = vk::PrimitiveTopology::triangleList;
 	trianglePipe.pInputAssemblyState = &assemblyInfo;
 
 	vk::PipelineRasterizationStateCreateInfo rasterizationInfo;
@@ -244,26 +1387,22 @@ vk::Pipeline createGraphicsPipelines(const vpp::Device& device,
 	dynamicInfo.pDynamicStates = dynStates.begin();
 	trianglePipe.pDynamicState = &dynamicInfo;
 
-	// setup cache
-	constexpr auto cacheName = "graphicsCache.bin";
-	vpp::PipelineCache cache {device, cacheName};
-
 	vk::Pipeline ret;
 	vk::createGraphicsPipelines(device, cache, 1, trianglePipe, nullptr, ret);
-	vpp::save(cache, cacheName);
-
 	return ret;
 }
 
 vpp::RenderPass createRenderPass(const vpp::Device& dev,
-	vk::Format format, vk::SampleCountBits sampleCount)
+	vk::Format format, vk::SampleCountBits sampleCount,
+	vk::ImageLayout finalLayout, bool resolve)
 {
 	vk::AttachmentDescription attachments[2] {};
 	auto msaa = sampleCount != vk::SampleCountBits::e1;
+	auto sampled = !resolve; // resolved/post-processed in a compute shader
 
 	auto swapchainID = 0u;
-	if(msaa) {
-		// multisample color attachment
+	if(msaa || sampled) {
+		// multisample (or single sampled offscreen) color attachment
 		attachments[0].format = format;
 		attachments[0].samples = sampleCount;
 		attachments[0].loadOp = vk::AttachmentLoadOp::clear;
@@ -271,7 +1410,11 @@ vpp::RenderPass createRenderPass(const vpp::Device& dev,
 		attachments[0].stencilLoadOp = vk::AttachmentLoadOp::dontCare;
 		attachments[0].stencilStoreOp = vk::AttachmentStoreOp::dontCare;
 		attachments[0].initialLayout = vk::ImageLayout::undefined;
-		attachments[0].finalLayout = vk::ImageLayout::presentSrcKHR;
+		attachments[0].finalLayout = vk::ImageLayout::colorAttachmentOptimal;
+		if(sampled) {
+			attachments[0].storeOp = vk::AttachmentStoreOp::store;
+			attachments[0].finalLayout = vk::ImageLayout::shaderReadOnlyOptimal;
+		}
 
 		swapchainID = 1u;
 	}
@@ -285,7 +1428,7 @@ vpp::RenderPass createRenderPass(const vpp::Device& dev,
 	attachments[swapchainID].stencilLoadOp = vk::AttachmentLoadOp::dontCare;
 	attachments[swapchainID].stencilStoreOp = vk::AttachmentStoreOp::dontCare;
 	attachments[swapchainID].initialLayout = vk::ImageLayout::undefined;
-	attachments[swapchainID].finalLayout = vk::ImageLayout::presentSrcKHR;
+	attachments[swapchainID].finalLayout = finalLayout;
 
 	// refs
 	vk::AttachmentReference colorReference;
@@ -301,12 +1444,19 @@ vpp::RenderPass createRenderPass(const vpp::Device& dev,
 
 	dependencies[0].srcSubpass = vk::subpassExternal;
 	dependencies[0].dstSubpass = 0;
-	dependencies[0].srcStageMask = vk::PipelineStageBits::bottomOfPipe;
+	// the multisample target is shared between all frames in flight,
+	// so we have to synchronize with the previous frames writes to it
+	dependencies[0].srcStageMask = vk::PipelineStageBits::colorAttachmentOutput;
 	dependencies[0].dstStageMask = vk::PipelineStageBits::colorAttachmentOutput;
-	dependencies[0].srcAccessMask = vk::AccessBits::memoryRead;
+	dependencies[0].srcAccessMask = vk::AccessBits::colorAttachmentWrite;
 	dependencies[0].dstAccessMask = vk::AccessBits::colorAttachmentRead |
 		vk::AccessBits::colorAttachmentWrite;
 	dependencies[0].dependencyFlags = vk::DependencyBits::byRegion;
+	if(sampled) {
+		// previous frames resolve must have finished reading it
+		dependencies[0].srcStageMask |= vk::PipelineStageBits::computeShader;
+		dependencies[0].dependencyFlags = {};
+	}
 
 	dependencies[1].srcSubpass = 0;
 	dependencies[1].dstSubpass = vk::subpassExternal;
@@ -316,25 +1466,36 @@ vpp::RenderPass createRenderPass(const vpp::Device& dev,
 		vk::AccessBits::colorAttachmentWrite;
 	dependencies[1].dstAccessMask = vk::AccessBits::memoryRead;
 	dependencies[1].dependencyFlags = vk::DependencyBits::byRegion;
+	if(finalLayout == vk::ImageLayout::transferSrcOptimal) {
+		// the target is read by a transfer after the render pass (e.g.
+		// the upscale blit). Since that might be a shared target, we
+		// also have to wait for the previous frames transfer
+		dependencies[0].srcStageMask |= vk::PipelineStageBits::transfer;
+		dependencies[1].dstStageMask |= vk::PipelineStageBits::transfer;
+		dependencies[1].dstAccessMask |= vk::AccessBits::transferRead;
+	}
+	if(sampled) {
+		// the compute resolve reads neighboring pixels, not by region
+		dependencies[1].dstStageMask = vk::PipelineStageBits::computeShader;
+		dependencies[1].dstAccessMask = vk::AccessBits::shaderRead;
+		dependencies[1].dependencyFlags = {};
+	}
 
 	// only subpass
 	vk::SubpassDescription subpass;
 	subpass.pipelineBindPoint = vk::PipelineBindPoint::graphics;
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &colorReference;
-	if(sampleCount != vk::SampleCountBits::e1)
+	if(msaa && !sampled)
 		subpass.pResolveAttachments = &resolveReference;
 
 	vk::RenderPassCreateInfo renderPassInfo;
-	renderPassInfo.attachmentCount = 1 + msaa;
+	renderPassInfo.attachmentCount = 1 + (msaa && !sampled);
 	renderPassInfo.pAttachments = attachments;
 	renderPassInfo.subpassCount = 1;
 	renderPassInfo.pSubpasses = &subpass;
-
-	if(msaa) {
-		renderPassInfo.dependencyCount = dependencies.size();
-		renderPassInfo.pDependencies = dependencies.data();
-	}
+	renderPassInfo.dependencyCount = dependencies.size();
+	renderPassInfo.pDependencies = dependencies.data();
 
 	return {dev, renderPassInfo};
 }
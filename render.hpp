@@ -7,36 +7,420 @@
 #include <vpp/device.hpp> // vpp::Device
 #include <vpp/queue.hpp> // vpp::Queue
 #include <vpp/buffer.hpp> // vpp::Buffer
+#include <vpp/image.hpp> // vpp::Image
 #include <vpp/pipeline.hpp> // vpp::Pipeline
-#include <vpp/renderer.hpp> // vpp::DefaultRenderer
-#include <vpp/descriptor.hpp> // vpp::DescriptorSet
+#include <vpp/swapchain.hpp> // vpp::Swapchain
+#include <vpp/commandBuffer.hpp> // vpp::CommandBuffer
+#include <vpp/descriptor.hpp> // vpp::DescriptorPool
 #include <vpp/handles.hpp>
-#include <vpp/queue.hpp>
 #include <vpp/vk.hpp> // FIXME
 #include <nytl/vec.hpp>
+#include <stats.hpp> // SampleStats, PhaseTimer
+#include <pipelines.hpp> // PipelineStore
+#include <scene.hpp> // Scene
+#include <upload.hpp> // Uploader, RingBuffer
+#include <record.hpp> // RecordPool
+#include <resolve.hpp> // ComputeResolve, ResolveMode
+#include <readback.hpp> // FrameReadback
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
 
 class Engine;
 
-class Renderer : public vpp::DefaultRenderer {
+/// Returns the name of the given present mode, e.g. for logging.
+const char* name(vk::PresentModeKHR);
+
+/// Parses a present mode from its name ("fifo", "fifo-relaxed", "mailbox"
+/// or "immediate"). Returns false for an invalid name.
+bool parsePresentMode(const char* name, vk::PresentModeKHR&);
+
+/// Settings a Renderer is created with.
+struct RendererSettings {
+	vk::SampleCountBits samples = vk::SampleCountBits::e1;
+	/// How the multisample image is resolved, see ResolveMode.
+	ResolveMode resolve = ResolveMode::renderPass;
+	/// Initial size of the render targets.
+	nytl::Vec2ui size = {800, 500};
+	/// Requested present mode, see Renderer::presentMode.
+	/// Ignored in headless mode.
+	vk::PresentModeKHR presentMode = vk::PresentModeKHR::fifo;
+	/// Requested number of swapchain images, 0 for the default.
+	unsigned int imageCount = 0;
+	/// Maximum number of frames the cpu may be ahead of the gpu, at least 1.
+	unsigned int framesInFlight = 2;
+	/// Whether to write gpu timestamps for every frame.
+	bool timestamps = true;
+	/// Whether to query pipeline statistics for every frame.
+	/// Requires the pipelineStatisticsQuery feature to be enabled.
+	bool pipelineStatistics = false;
+	/// Whether to compile the pipelines for all supported sample counts
+	/// on a background thread at startup.
+	bool prewarmPipelines = true;
+	/// Number of worker threads that record the draws into secondary
+	/// command buffers every frame. 0 records them directly into the
+	/// primary command buffer. Pipeline statistics are not supported
+	/// with secondary command buffers.
+	unsigned int recordThreads = 0;
+	/// Whether to render at a resolution decoupled from the target size
+	/// that is upscaled to it, see Renderer::renderScale.
+	/// Requires blit support for the target format.
+	bool dynamicResolution = false;
+	/// Initial render scale, only used with dynamicResolution.
+	float renderScale = 1.f;
+	/// File to load and store the pipeline cache from, empty for none.
+	std::string pipelineCache = "graphicsCache.bin";
+	/// Contents of pipelineCache if already read, see PipelineStore.
+	std::vector<std::uint8_t> pipelineCacheData;
+	/// The scene to render.
+	SceneSettings scene;
+	/// Instances of the scene if already generated, see Scene.
+	std::vector<Instance> instances;
+	/// If set, every frame is copied back to the host and passed to the
+	/// sink on a worker thread, see FrameReadback. With a swapchain,
+	/// requires the images to support transferSrc usage.
+	ReadbackSink readback;
+	/// Number of readback buffers in addition to the frames in flight.
+	unsigned int readbackSlots = 3;
+};
+
+/// Pipeline statistics of a single frame.
+struct PipelineStatistics {
+	std::uint64_t inputAssemblyVertices;
+	std::uint64_t vertexShaderInvocations;
+	std::uint64_t clippingPrimitives;
+	std::uint64_t fragmentShaderInvocations;
+};
+
+/// Timings of the last frames, all values in milliseconds.
+struct FrameStats {
+	StatsSummary cpu; // time spent in Renderer::render, excluding waits
+	StatsSummary gpu; // whole command buffer on the gpu
+	StatsSummary resolve; // end of draws to end of render pass
+	StatsSummary interval; // between the start of two frames
+};
+
+/// Device memory used by the renderers resources.
+struct MemoryReport {
+	struct Entry {
+		std::string name;
+		vk::DeviceSize size; // required size of the resource
+		bool lazy; // whether in lazily allocated memory
+		vk::DeviceSize committed; // actually committed size if lazy
+		bool owned; // false for swapchain images, size is an estimate then
+	};
+
+	std::vector<Entry> entries;
+	vk::DeviceSize total; // sum of committed/required sizes of all entries
+};
+
+/// Renders the (multisampled) triangle.
+/// Either renders into the images of a swapchain for the given surface or,
+/// when no surface is given (headless mode), into offscreen images owned
+/// by the renderer. Headless mode needs no window system and no
+/// swapchain extension and therefore also works e.g. on lavapipe.
+class Renderer {
 public:
-	Renderer(const vpp::Device&, vk::SurfaceKHR, vk::SampleCountBits samples,
-		const vpp::Queue& present);
-	~Renderer() = default;
+	/// Format of the offscreen images in headless mode.
+	static constexpr auto offscreenFormat = vk::Format::r8g8b8a8Unorm;
+
+	/// Lowest supported render scale.
+	static constexpr auto minRenderScale = 0.25f;
 
+public:
+	/// Creates a renderer for the given surface. If surface is a null handle,
+	/// the renderer will render into offscreen images of the given size.
+	/// The given queue must support graphics (and presenting on surface).
+	/// If a transfer queue is given, uploads are done on it,
+	/// otherwise on the graphics queue.
+	Renderer(const vpp::Device&, vk::SurfaceKHR, const vpp::Queue& queue,
+		const RendererSettings& settings = {},
+		const vpp::Queue* transfer = nullptr);
+	~Renderer();
+
+	/// Queues a resize of the render targets. Multiple resizes between
+	/// two frames are coalesced, only the last size is applied at the start
+	/// of the next frame. Swapchain recreation passes the old swapchain
+	/// and does not wait for pending frames.
 	void resize(nytl::Vec2ui size);
+
+	/// Queues a switch to the given sample count. Does not block, the
+	/// pipeline is compiled in the background (if not already cached) and
+	/// the switch takes effect at the start of the first frame after that.
+	/// The resources of the old sample count are destroyed as soon as
+	/// all frames using them have completed.
 	void samples(vk::SampleCountBits);
 
+	/// Sets the render resolution relative to the target size, clamped to
+	/// [minRenderScale, 1]. Takes effect with the next frame and does not
+	/// recreate any resources: the render targets are always allocated
+	/// at full size and only partly rendered to. The result is upscaled
+	/// with a linear blit. Only available with dynamicResolution.
+	/// The getter returns the last requested scale.
+	void renderScale(float);
+	float renderScale() const { return pendingScale_; }
+	bool dynamicResolution() const { return dynamicResolution_; }
+
+	/// Returns the size that is currently rendered at.
+	vk::Extent2D renderExtent() const;
+
+	/// Queues a switch to the given present mode and number of swapchain
+	/// images (0 for the default of one more than the minimum).
+	/// The swapchain is recreated at the start of the next frame, like
+	/// with resize. Unsupported modes fall back to fifo (immediate tries
+	/// mailbox first), the image count is clamped to the surface limits.
+	/// Has no effect in headless mode.
+	void presentMode(vk::PresentModeKHR, unsigned int imageCount = 0);
+	vk::PresentModeKHR presentMode() const { return scInfo_.presentMode; }
+	unsigned int imageCount() const { return renderBuffers_.size(); }
+
+	/// Returns the maximum number of frames between the start of a frame
+	/// and it being presented, resulting from present mode and image count.
+	/// With fifo, presented images are queued until all swapchain images
+	/// are in use, mailbox and immediate replace or tear instead.
+	unsigned int presentLatency() const;
+
+	/// Queues a switch to the given resolve mode, like samples.
+	/// Compute resolve modes are only supported if the device can write
+	/// rgba8 storage images and blit them to the render targets, see
+	/// computeResolveSupported.
+	/// Otherwise (and for a single sample) the render pass resolves.
+	/// ResolveMode::fxaa is the exception, it only has an effect with a
+	/// single sample.
+	void resolve(ResolveMode);
+
+	/// Renders one frame without waiting for its completion.
+	/// Will only block if there are already framesInFlight frames
+	/// pending on the gpu.
+	void render();
+
+	/// Renders one frame and waits for its completion.
+	void renderStall();
+
+	/// Marks the presented content as outdated, e.g. after the window
+	/// was exposed. See redrawNeeded.
+	void redraw() { damaged_ = true; }
+
+	/// Returns whether the next frame would differ from the last one,
+	/// i.e. if redraw was called, a resize or switch is pending (until it
+	/// was applied) or the scene is animated or still streamed in.
+	/// Allows to render only on demand instead of continuously.
+	bool redrawNeeded() const;
+
+	/// Waits for all submitted frames to complete.
+	void wait();
+
+	/// Returns the number of submitted frames that have not completed yet.
+	unsigned int queueDepth() const;
+	unsigned int framesInFlight() const { return frames_.size(); }
+
+	/// Returns the timing statistics of the last completed frames.
+	/// Gpu timings are only available if timestamps are enabled.
+	FrameStats frameStats() const;
+	void resetFrameStats();
+
+	/// Returns the gpu time of the last completed frame in milliseconds.
+	/// Only valid if timestamps are enabled, see timestamps.
+	float lastGpuTime() const { return lastGpuTime_; }
+	bool timestamps() const { return timestamps_; }
+
+	/// Returns the number of frames that were submitted and completed.
+	std::uint64_t submittedFrames() const { return frameNumber_; }
+	std::uint64_t completedFrames() const { return completedFrames_; }
+
+	/// Returns the pipeline statistics of the last completed frame.
+	/// Only valid if pipelineStatistics was enabled.
+	const PipelineStatistics& pipelineStatistics() const { return pipelineStats_; }
+
+	/// The rendered scene. A mesh scene is streamed in over multiple
+	/// frames, see Scene::streaming.
+	const Scene& scene() const { return *scene_; }
+
+	/// Returns the device memory used by the current resources.
+	/// Does not include retired resources.
+	MemoryReport memoryReport() const;
+
+	/// Returns the durations of the phases of the constructor.
+	const PhaseTimer& startupTimes() const { return startup_; }
+
+	bool headless() const { return !surface_; }
+	vk::SampleCountBits samples() const { return targets_->samples; }
+	/// The last requested sample count, see samples(vk::SampleCountBits).
+	vk::SampleCountBits pendingSamples() const { return pendingSamples_; }
+	ResolveMode resolve() const { return resolveMode_; }
+	bool computeResolveSupported() const { return computeResolve_ != nullptr; }
+	vk::Extent2D extent() const { return scInfo_.imageExtent; }
+	vk::Format format() const { return scInfo_.imageFormat; }
+	const vpp::Device& device() const { return *device_; }
+
 protected:
-	void createMultisampleTarget(const vk::Extent2D& size);
-	void record(const RenderBuffer&) override;
-	void initBuffers(const vk::Extent2D&, nytl::Span<RenderBuffer>) override;
+	/// A target the renderer can render into.
+	/// Either a swapchain image or an owned offscreen image.
+	struct RenderBuffer {
+		vk::Image image;
+		vpp::Image offscreen; // only valid in headless mode
+		vpp::ImageView imageView;
+	};
+
+	/// All resources that depend on the sample count.
+	/// Switched as a whole at frame boundaries.
+	struct SampleTargets {
+		vk::SampleCountBits samples;
+		bool computeResolve {}; // render pass without resolve attachment
+		vk::RenderPass renderPass; // owned by pipelines_
+		vk::Pipeline pipeline; // owned by pipelines_
+		vk::Extent2D extent; // framebuffer size
+		// only valid if multisampled or post-processed (then single sampled).
+		// Might be larger than extent and shared with retired targets,
+		// see createTargets
+		std::shared_ptr<vpp::ViewableImage> multisampleTarget;
+		vk::Extent2D multisampleExtent;
+		bool multisampleLazy {}; // whether in lazily allocated memory
+		std::vector<vpp::Framebuffer> framebuffers; // for each RenderBuffer
+		// intermediate target that is upscaled, only with dynamic
+		// resolution and a render pass resolve
+		vpp::ViewableImage upscaleTarget;
+		// the compute resolve writes this rgba8 storage image, which is
+		// then blitted (and upscaled) to the render buffer. The render
+		// buffers themselves never need storage usage, which might
+		// disable framebuffer compression, and may have any format.
+		// Only valid with computeResolve
+		vpp::ViewableImage resolveTarget;
+		vpp::DescriptorPool resolvePool;
+		vk::DescriptorSet resolveSet;
+	};
+
+	/// Resources that were replaced but might still be in use by
+	/// pending frames.
+	struct Retired {
+		std::unique_ptr<SampleTargets> targets;
+		std::vector<RenderBuffer> renderBuffers;
+		vpp::Swapchain swapchain;
+		std::unique_ptr<FrameReadback> readback;
+		std::uint64_t lastFrame; // number of frames that may use them
+	};
+
+	/// Per-frame submission resources.
+	struct Frame {
+		vpp::CommandBuffer commandBuffer;
+		vpp::Fence fence;
+		vpp::Semaphore acquireSemaphore;
+		vpp::Semaphore renderSemaphore;
+		bool pending {}; // whether fence was submitted and not waited on
+		std::uint64_t number {}; // number of the last submission
+		vpp::QueryPool timestampPool; // only valid if timestamps are used
+		vpp::QueryPool statisticsPool; // only valid if statistics are used
+		std::uint64_t submitTime {}; // trace time of the last submission
+		FrameReadback* readback {}; // set while a readback is pending
+		unsigned int readbackSlot {};
+	};
+
+	/// Timestamp query indices in the per-frame timestamp pool.
+	enum Timestamp : unsigned int {
+		timestampBegin, // before the render pass
+		timestampDraw, // after the draw commands, before the resolve
+		timestampEnd, // after the render pass (including the resolve)
+		queryTimestampCount
+	};
+
+	vpp::ViewableImage createMultisampleTarget(const vk::Extent2D& size,
+		vk::SampleCountBits samples, bool sampled, bool& lazy);
+	std::unique_ptr<SampleTargets> createTargets(vk::SampleCountBits,
+		bool computeResolve, const PipelineStore::Entry&,
+		const SampleTargets* reuse = nullptr);
+	/// Returns whether the targets for the given sample count and mode
+	/// are resolved in a compute shader.
+	bool computeTargets(vk::SampleCountBits, ResolveMode) const;
+	/// Creates the render buffers and the targets for the current
+	/// sample count and size. Returns the previous targets.
+	std::unique_ptr<SampleTargets> createBuffers();
+	void applySamples();
+	void applyResize();
+	/// Sets present mode and image count in scInfo_ from the requested
+	/// ones, falling back to supported values.
+	void choosePresentMode();
+	void destroyRetired();
+	void record(const Frame&, unsigned int buffer);
+	void recordResolve(vk::CommandBuffer);
+	/// Blits the renderExtent area of src (in transferSrcOptimal) to the
+	/// whole render buffer.
+	void recordBlit(vk::CommandBuffer, unsigned int buffer, vk::Image src);
+	void recordReadback(const Frame&, unsigned int buffer);
+	/// Layout the render buffers are left in at the end of a frame.
+	vk::ImageLayout finalLayout() const;
+	void recordDraws(vk::CommandBuffer, unsigned int first, unsigned int count);
+	void waitFrame(Frame&);
+	void readQueries(Frame&);
 
 protected:
-	vpp::Pipeline trianglePipeline_;
-	vpp::PipelineLayout graphicsLayout_;
-	vpp::Buffer vertexBuffer_;
-	vpp::ViewableImage multisampleTarget_;
-	vpp::RenderPass renderPass_;
-	vk::SampleCountBits sampleCount_;
+	const vpp::Device* device_;
+	const vpp::Queue* queue_;
+	vk::SurfaceKHR surface_;
+
+	PhaseTimer startup_; // constructed first, see startupTimes
+	PipelineStore pipelines_;
+	std::unique_ptr<Uploader> uploader_;
+	std::unique_ptr<Scene> scene_;
+	std::unique_ptr<RingBuffer> ring_; // only valid if the scene is animated
+	std::unique_ptr<RecordPool> recordPool_; // only valid if recordThreads > 0
+	std::chrono::steady_clock::time_point startTime_; // for animation
 	vk::SwapchainCreateInfoKHR scInfo_;
+
+	std::unique_ptr<SampleTargets> targets_;
+	std::vector<Retired> retired_;
+	vk::SampleCountBits pendingSamples_ {}; // requested sample count
+	ResolveMode resolveMode_ {};
+	ResolveMode pendingResolve_ {}; // requested resolve mode
+	std::unique_ptr<ComputeResolve> computeResolve_; // only if supported
+	bool dynamicResolution_ {};
+	float renderScale_ {1.f};
+	float pendingScale_ {1.f};
+	nytl::Vec2ui pendingSize_ {}; // requested size
+	bool damaged_ {true}; // whether redraw was called since the last frame
+	vk::PresentModeKHR requestedPresentMode_ {};
+	unsigned int requestedImageCount_ {}; // 0 for the default
+	bool resizePending_ {};
+
+	vpp::Swapchain swapchain_; // not valid in headless mode
+	std::vector<RenderBuffer> renderBuffers_;
+	std::vector<Frame> frames_;
+	ReadbackSink readbackSink_;
+	unsigned int readbackSlots_ {};
+	std::unique_ptr<FrameReadback> readback_; // only valid with readbackSink_
+	unsigned int frameIndex_ {};
+	std::uint64_t frameNumber_ {}; // number of submitted frames
+	std::uint64_t completedFrames_ {}; // number of completed frames
+
+	bool timestamps_ {};
+	bool pipelineStatistics_ {};
+	float timestampPeriod_ {}; // nanoseconds per timestamp tick
+	float lastGpuTime_ {};
+	// offset from gpu timestamps to trace time in ns, see readQueries
+	std::int64_t gpuTraceOffset_ {std::numeric_limits<std::int64_t>::min()};
+	PipelineStatistics pipelineStats_ {};
+	SampleStats cpuTimes_;
+	SampleStats gpuTimes_;
+	SampleStats resolveTimes_;
+	SampleStats frameIntervals_;
+	std::chrono::steady_clock::time_point lastFrameStart_ {};
 };
+
+/// Creates the triangle pipeline, reading vertices in the given format.
+/// With bakedColors, the vertex colors are used as they are instead of
+/// being blended and tinted, see triangle.vert.
+vk::Pipeline createGraphicsPipelines(const vpp::Device&, vk::RenderPass,
+	vk::PipelineLayout, vk::SampleCountBits, vk::PipelineCache,
+	vk::ShaderModule vertex, vk::ShaderModule fragment,
+	VertexFormat = VertexFormat::float32, bool bakedColors = false);
+
+/// Creates the render pass for the given format and sample count.
+/// The (resolved) single sampled color attachment will be transitioned
+/// into the given finalLayout, i.e. presentSrcKHR for swapchain images.
+/// If resolve is false, the render pass has only the (multisample) offscreen
+/// attachment which is stored and transitioned into shaderReadOnlyOptimal
+/// for a compute resolve or post-process pass.
+vpp::RenderPass createRenderPass(const vpp::Device&, vk::Format,
+	vk::SampleCountBits, vk::ImageLayout finalLayout, bool resolve = true);
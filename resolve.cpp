@@ -0,0 +1,166 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <resolve.hpp>
+#include <dlg/dlg.hpp> // dlg
+#include <cstring> // std::strcmp
+
+// shader data
+#include <shaders/resolve.comp.h>
+#include <shaders/fxaa.comp.h>
+
+const char* name(ResolveMode mode)
+{
+	switch(mode) {
+		case ResolveMode::renderPass: return "renderpass";
+		case ResolveMode::box: return "box";
+		case ResolveMode::tent: return "tent";
+		case ResolveMode::tonemap: return "tonemap";
+		case ResolveMode::fxaa: return "fxaa";
+	}
+
+	return "<invalid>";
+}
+
+bool parseResolveMode(const char* str, ResolveMode& mode)
+{
+	for(auto m : {ResolveMode::renderPass, ResolveMode::box,
+			ResolveMode::tent, ResolveMode::tonemap, ResolveMode::fxaa}) {
+		if(!std::strcmp(str, name(m))) {
+			mode = m;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+ComputeResolve::ComputeResolve(const vpp::Device& dev, vk::PipelineCache cache)
+	: device_(&dev)
+{
+	// layouts
+	vk::DescriptorSetLayoutBinding bindings[2] {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = vk::DescriptorType::combinedImageSampler;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = vk::ShaderStageBits::compute;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = vk::DescriptorType::storageImage;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = vk::ShaderStageBits::compute;
+	descriptorLayout_ = {dev, bindings};
+
+	vk::PushConstantRange range {vk::ShaderStageBits::compute, 0, 12};
+	layout_ = {dev, {descriptorLayout_}, {range}};
+
+	// multisample images are only fetched, only fxaa filters
+	vk::SamplerCreateInfo samplerInfo;
+	samplerInfo.magFilter = vk::Filter::linear;
+	samplerInfo.minFilter = vk::Filter::linear;
+	samplerInfo.mipmapMode = vk::SamplerMipmapMode::nearest;
+	samplerInfo.addressModeU = vk::SamplerAddressMode::clampToEdge;
+	samplerInfo.addressModeV = vk::SamplerAddressMode::clampToEdge;
+	samplerInfo.addressModeW = vk::SamplerAddressMode::clampToEdge;
+	samplerInfo.maxLod = 0.f;
+	sampler_ = {dev, samplerInfo};
+
+	// one pipeline per filter and sample count, selected by
+	// specialization constants
+	shader_ = {dev, resolve_comp_data};
+	fxaaShader_ = {dev, fxaa_comp_data};
+
+	struct {
+		std::uint32_t mode;
+		std::uint32_t samples;
+	} constants[filterCount][sampleCounts];
+
+	vk::SpecializationMapEntry entries[] = {{0u, 0u, 4u}, {1u, 4u, 4u}};
+	vk::SpecializationInfo specs[filterCount][sampleCounts];
+	vk::ComputePipelineCreateInfo infos[filterCount * sampleCounts + 1];
+	for(auto m = 0u; m < filterCount; ++m) {
+		for(auto s = 0u; s < sampleCounts; ++s) {
+			constants[m][s] = {m, 1u << s};
+			auto& spec = specs[m][s];
+			spec.mapEntryCount = 2;
+			spec.pMapEntries = entries;
+			spec.dataSize = sizeof(constants[m][s]);
+			spec.pData = &constants[m][s];
+
+			auto& info = infos[m * sampleCounts + s];
+			info.layout = layout_;
+			info.stage.stage = vk::ShaderStageBits::compute;
+			info.stage.module = shader_;
+			info.stage.pName = "main";
+			info.stage.pSpecializationInfo = &spec;
+		}
+	}
+
+	auto& fxaa = infos[filterCount * sampleCounts];
+	fxaa.layout = layout_;
+	fxaa.stage.stage = vk::ShaderStageBits::compute;
+	fxaa.stage.module = fxaaShader_;
+	fxaa.stage.pName = "main";
+
+	auto pipelines = vk::createComputePipelines(dev, cache, infos);
+	for(auto m = 0u; m < filterCount; ++m) {
+		for(auto s = 0u; s < sampleCounts; ++s) {
+			pipelines_[m][s] = {dev, pipelines[m * sampleCounts + s]};
+		}
+	}
+
+	fxaaPipeline_ = {dev, pipelines.back()};
+	dlg_debug("ComputeResolve: created pipelines");
+}
+
+void ComputeResolve::write(vk::DescriptorSet set, vk::ImageView multisample,
+	vk::ImageView storage) const
+{
+	vk::DescriptorImageInfo input {sampler_, multisample,
+		vk::ImageLayout::shaderReadOnlyOptimal};
+	vk::DescriptorImageInfo output {{}, storage, vk::ImageLayout::general};
+
+	vk::WriteDescriptorSet writes[2] {};
+	writes[0].dstSet = set;
+	writes[0].dstBinding = 0;
+	writes[0].descriptorCount = 1;
+	writes[0].descriptorType = vk::DescriptorType::combinedImageSampler;
+	writes[0].pImageInfo = &input;
+	writes[1].dstSet = set;
+	writes[1].dstBinding = 1;
+	writes[1].descriptorCount = 1;
+	writes[1].descriptorType = vk::DescriptorType::storageImage;
+	writes[1].pImageInfo = &output;
+
+	vk::updateDescriptorSets(device(), writes, {});
+}
+
+void ComputeResolve::record(vk::CommandBuffer cmdBuf, ResolveMode mode,
+	vk::DescriptorSet set, vk::SampleCountBits samples,
+	const vk::Extent2D& extent) const
+{
+	dlg_assert(compute(mode));
+
+	vk::Pipeline pipeline = fxaaPipeline_;
+	if(mode != ResolveMode::fxaa) {
+		auto s = 0u;
+		while((1u << s) < static_cast<unsigned int>(samples)) {
+			++s;
+		}
+
+		dlg_assert(s < sampleCounts);
+		pipeline = pipelines_[static_cast<unsigned int>(mode) - 1][s];
+	}
+
+	std::uint32_t params[] = {extent.width, extent.height,
+		static_cast<std::uint32_t>(samples)};
+
+	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute, pipeline);
+	vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::compute,
+		layout_, 0, {set}, {});
+	vk::cmdPushConstants(cmdBuf, layout_, vk::ShaderStageBits::compute, 0,
+		sizeof(params), params);
+	vk::cmdDispatch(cmdBuf,
+		(extent.width + groupSize - 1) / groupSize,
+		(extent.height + groupSize - 1) / groupSize, 1);
+}
@@ -0,0 +1,78 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <vpp/device.hpp> // vpp::Device
+#include <vpp/pipeline.hpp> // vpp::Pipeline
+#include <vpp/shader.hpp> // vpp::ShaderModule
+#include <vpp/descriptor.hpp> // vpp::DescriptorSetLayout
+#include <vpp/handles.hpp>
+#include <vpp/vk.hpp>
+
+#include <array>
+
+/// How the multisample image is resolved into the presented image.
+enum class ResolveMode : unsigned int {
+	renderPass, // resolve attachment of the render pass (box filter)
+	box, // compute shader, box filter
+	tent, // compute shader, tent filter over the neighboring pixels
+	tonemap, // compute shader, box filter in tonemapped space
+	fxaa, // no multisampling, fxaa post-process pass in a compute shader
+};
+
+/// Returns the name of the given mode, e.g. for logging.
+const char* name(ResolveMode);
+
+/// Parses a mode from its name. Returns false for an invalid name.
+bool parseResolveMode(const char* name, ResolveMode&);
+
+/// Returns whether the mode resolves in a compute shader.
+inline bool compute(ResolveMode mode) { return mode != ResolveMode::renderPass; }
+
+/// Compute pipelines that resolve a multisample image into a single
+/// sampled storage image. All filters use the vulkan standard sample
+/// locations. Also implements fxaa, which reads a single sampled image
+/// instead.
+class ComputeResolve {
+public:
+	/// Format of the storage images, matches the shader.
+	static constexpr auto storageFormat = vk::Format::r8g8b8a8Unorm;
+
+	/// Workgroup size of the shader in both dimensions.
+	static constexpr auto groupSize = 8u;
+
+	/// Number of filters (box, tent, tonemap) and supported sample
+	/// counts (1, 2, 4, 8), a pipeline is created for each combination.
+	static constexpr auto filterCount = 3u;
+	static constexpr auto sampleCounts = 4u;
+
+public:
+	ComputeResolve(const vpp::Device&, vk::PipelineCache = {});
+
+	/// Writes the given multisample image view (in shaderReadOnlyOptimal
+	/// layout) and storage image view (in general layout) into the set.
+	void write(vk::DescriptorSet, vk::ImageView multisample,
+		vk::ImageView storage) const;
+
+	/// Records the resolve with the given compute mode. Does not record
+	/// any barriers. extent is the area to resolve, may be smaller
+	/// than the images.
+	void record(vk::CommandBuffer, ResolveMode, vk::DescriptorSet,
+		vk::SampleCountBits, const vk::Extent2D& extent) const;
+
+	vk::DescriptorSetLayout descriptorLayout() const { return descriptorLayout_; }
+	const vpp::Device& device() const { return *device_; }
+
+protected:
+	const vpp::Device* device_;
+	vpp::DescriptorSetLayout descriptorLayout_;
+	vpp::PipelineLayout layout_;
+	vpp::Sampler sampler_;
+	vpp::ShaderModule shader_;
+	vpp::ShaderModule fxaaShader_;
+	// [filter][log2(samples)]
+	std::array<std::array<vpp::Pipeline, sampleCounts>, filterCount> pipelines_;
+	vpp::Pipeline fxaaPipeline_;
+};
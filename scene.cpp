@@ -0,0 +1,312 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <scene.hpp>
+#include <mesh.hpp> // MeshFile
+#include <upload.hpp> // Uploader, RingBuffer
+#include <trace.hpp> // TRACE_SCOPE
+
+#include <dlg/dlg.hpp> // dlg
+#include <algorithm> // std::min, std::max
+#include <cmath> // std::sqrt
+#include <cstring> // std::strcmp
+#include <random>
+#include <stdexcept> // std::runtime_error
+
+namespace {
+
+// mesh uploads that may be pending at once, limits the staging memory
+constexpr auto maxStreamBatches = 4u;
+
+} // anon namespace
+
+const char* name(VertexFormat format)
+{
+	switch(format) {
+		case VertexFormat::float32: return "float32";
+		case VertexFormat::half: return "half";
+		case VertexFormat::packed: return "packed";
+	}
+
+	return "<invalid>";
+}
+
+bool parseVertexFormat(const char* str, VertexFormat& format)
+{
+	for(auto f : {VertexFormat::float32, VertexFormat::half,
+			VertexFormat::packed}) {
+		if(!std::strcmp(str, name(f))) {
+			format = f;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+unsigned int vertexSize(VertexFormat format)
+{
+	return format == VertexFormat::float32 ? 5 * sizeof(float) :
+		sizeof(PackedVertex);
+}
+
+std::vector<Instance> generateInstances(const SceneSettings& settings)
+{
+	constexpr auto pi = 3.14159265359f;
+
+	// a single triangle is the original, untransformed triangle
+	auto count = settings.count;
+	std::vector<Instance> instances(count);
+	if(count == 1) {
+		instances[0] = {{0.f, 0.f}, {settings.size, settings.size},
+			{1.f, 0.f}, 1.f, 0.f};
+		return instances;
+	}
+
+	// place the triangles on a jittered grid over the screen
+	// and move them to the center for overlap
+	auto grid = static_cast<unsigned int>(std::ceil(std::sqrt(count)));
+	auto cell = 2.f / grid;
+	auto scale = settings.size / grid;
+	auto stretch = std::sqrt(std::max(settings.edgeDensity, 1.f));
+
+	std::mt19937 rng(settings.seed);
+	std::uniform_real_distribution<float> jitter(-0.25f * cell, 0.25f * cell);
+	std::uniform_real_distribution<float> angle(0.f, 2 * pi);
+	std::uniform_real_distribution<float> tint(0.5f, 1.f);
+
+	for(auto i = 0u; i < count; ++i) {
+		auto& ini = instances[i];
+		nytl::Vec2f center {
+			-1.f + (i % grid + 0.5f) * cell + jitter(rng),
+			-1.f + (i / grid + 0.5f) * cell + jitter(rng)};
+
+		auto spread = 1.f - settings.overlap;
+		ini.offset = {spread * center.x, spread * center.y};
+		ini.scale = {scale * stretch, scale / stretch};
+
+		auto a = angle(rng);
+		ini.rotation = {std::cos(a), std::sin(a)};
+		ini.tint = tint(rng);
+	}
+
+	return instances;
+}
+
+Scene::Scene(const vpp::Device& dev, Uploader& uploader,
+	const SceneSettings& settings, std::vector<Instance> instances)
+		: vertexFormat_(vertexFormat(settings))
+{
+	if(!settings.mesh.empty()) {
+		createMesh(uploader, settings);
+		return;
+	}
+
+	if(instances.empty()) {
+		instances = generateInstances(settings);
+	}
+
+	// there are no zero sized buffers
+	if(instances.empty()) {
+		throw std::runtime_error("Scene: no triangles to render");
+	}
+
+	count_ = instances.size();
+	vertexCount_ = triangleVertexCount;
+	visibleVertices_ = vertexCount_;
+
+	// indirect draw commands, each drawing a range of instances
+	drawCount_ = std::max(std::min(settings.draws, count_), 1u);
+	std::vector<vk::DrawIndirectCommand> cmds(drawCount_);
+	for(auto i = 0u; i < drawCount_; ++i) {
+		auto first = count_ * i / drawCount_;
+		auto end = count_ * (i + 1) / drawCount_;
+		cmds[i] = {triangleVertexCount, end - first, 0, first};
+	}
+
+	// upload everything into device local memory
+	std::vector<std::uint8_t> vertices(vertexCount_ * vertexSize(vertexFormat_));
+	convertVertices(triangleVertices, vertexCount_, vertexFormat_,
+		vertices.data());
+	vertexBuffer_ = uploader.createBuffer(vk::BufferUsageBits::vertexBuffer,
+		vertices.data(), vertices.size());
+	instanceBuffer_ = uploader.createBuffer(vk::BufferUsageBits::vertexBuffer,
+		instances.data(), instanceDataSize());
+	indirectBuffer_ = uploader.createBuffer(vk::BufferUsageBits::indirectBuffer,
+		cmds.data(), cmds.size() * sizeof(cmds[0]));
+
+	if(settings.animate) {
+		instances_ = std::move(instances);
+	}
+
+	dlg_info("Scene: {} triangles in {} draws, {} vertices{}", count_,
+		drawCount_, name(vertexFormat_),
+		settings.animate ? ", animated" : "");
+}
+
+Scene::~Scene() = default;
+
+void Scene::createMesh(Uploader& uploader, const SceneSettings& settings)
+{
+	mesh_ = std::make_unique<MeshFile>(settings.mesh);
+	vertexCount_ = mesh_->vertexCount();
+	if(vertexCount_ == 0) {
+		throw std::runtime_error("Scene: mesh " + settings.mesh + " is empty");
+	}
+
+	count_ = 1u;
+	drawCount_ = std::max<std::uint64_t>(
+		std::min<std::uint64_t>(settings.draws, vertexCount_ / 3), 1u);
+	streamBudget_ = settings.streamBudget;
+
+	// the vertices are streamed in later, the instance maps the
+	// quantized positions to the bounds of the mesh
+	auto& header = mesh_->header();
+	Instance instance {header.offset, header.scale, {1.f, 0.f}, 1.f, 0.f};
+	vertexBuffer_ = uploader.createBuffer(vk::BufferUsageBits::vertexBuffer,
+		vertexCount_ * vertexSize(vertexFormat_));
+	instanceBuffer_ = uploader.createBuffer(vk::BufferUsageBits::vertexBuffer,
+		&instance, sizeof(instance));
+
+	if(settings.animate) {
+		dlg_warn("Scene: meshes can't be animated");
+	}
+
+	dlg_info("Scene: mesh with {} triangles in {} draws, {} vertices",
+		vertexCount_ / 3, drawCount_, name(vertexFormat_));
+}
+
+void Scene::stream(Uploader& uploader)
+{
+	if(!mesh_) {
+		return;
+	}
+
+	TRACE_SCOPE("stream");
+
+	// uploads complete in order
+	while(!streamBatches_.empty() &&
+			uploader.done(streamBatches_.front().id)) {
+		visibleVertices_ = streamBatches_.front().end;
+		streamBatches_.pop_front();
+	}
+
+	auto& chunks = mesh_->chunks();
+	if(nextChunk_ == chunks.size() || streamBatches_.size() >= maxStreamBatches) {
+		return;
+	}
+
+	// the uploader copies directly from the mapped file into staging
+	// memory, only the pages of the uploaded chunks are read.
+	// Other formats are converted first
+	auto vsize = vertexSize(vertexFormat_);
+	auto size = vk::DeviceSize(0);
+	while(nextChunk_ < chunks.size()) {
+		auto& chunk = chunks[nextChunk_];
+		auto count = chunk.header->vertexCount;
+		auto bytes = vk::DeviceSize(count) * vsize;
+		if(size > 0 && size + bytes > streamBudget_) {
+			break;
+		}
+
+		const void* data = chunk.vertices;
+		if(vertexFormat_ != VertexFormat::packed) {
+			converted_.resize(bytes);
+			convertVertices(chunk.vertices, count, vertexFormat_,
+				converted_.data());
+			data = converted_.data();
+		}
+
+		if(bytes > 0) {
+			uploader.write(vertexBuffer_, chunk.header->firstVertex * vsize,
+				data, bytes);
+		}
+
+		size += bytes;
+		++nextChunk_;
+	}
+
+	auto end = vertexCount_;
+	if(nextChunk_ < chunks.size()) {
+		end = chunks[nextChunk_].header->firstVertex;
+	}
+
+	streamBatches_.push_back({uploader.submit(), end});
+}
+
+bool Scene::streaming() const
+{
+	return visibleVertices_ < vertexCount_;
+}
+
+void Scene::update(RingBuffer& ring, std::uint64_t frame, float time)
+{
+	if(!animated()) {
+		return;
+	}
+
+	auto alloc = ring.allocate(instanceDataSize(), frame);
+	if(!alloc.data) {
+		dlg_warn("Scene: ring buffer full, using static instance data");
+		dynamicBuffer_ = {};
+		return;
+	}
+
+	// rotate every triangle around its center, the speed depends on
+	// its tint so they don't all rotate the same
+	auto data = static_cast<Instance*>(alloc.data);
+	for(auto i = 0u; i < count_; ++i) {
+		auto ini = instances_[i];
+		auto a = time * ini.tint;
+		auto c = std::cos(a);
+		auto s = std::sin(a);
+		ini.rotation = {
+			c * ini.rotation.x - s * ini.rotation.y,
+			s * ini.rotation.x + c * ini.rotation.y};
+		data[i] = ini;
+	}
+
+	dynamicBuffer_ = ring.buffer();
+	dynamicOffset_ = alloc.offset;
+}
+
+void Scene::record(vk::CommandBuffer cmdBuf) const
+{
+	record(cmdBuf, 0, drawCount_);
+}
+
+void Scene::record(vk::CommandBuffer cmdBuf, unsigned int first,
+	unsigned int count) const
+{
+	vk::Buffer instances = instanceBuffer_;
+	vk::DeviceSize offset = 0u;
+	if(dynamicBuffer_) {
+		instances = dynamicBuffer_;
+		offset = dynamicOffset_;
+	}
+
+	vk::cmdBindVertexBuffers(cmdBuf, 0, {vertexBuffer_, instances}, {0, offset});
+
+	// every draw covers an equal part of the mesh, clipped to the
+	// vertices that are already uploaded
+	if(mesh_) {
+		auto triangles = vertexCount_ / 3;
+		for(auto i = first; i < first + count; ++i) {
+			auto begin = 3 * (triangles * i / drawCount_);
+			auto end = std::min(3 * (triangles * (i + 1) / drawCount_),
+				visibleVertices_);
+			if(end > begin) {
+				vk::cmdDraw(cmdBuf, end - begin, 1, begin, 0);
+			}
+		}
+
+		return;
+	}
+
+	// one call per draw, drawCount > 1 would require multiDrawIndirect
+	constexpr auto stride = sizeof(vk::DrawIndirectCommand);
+	for(auto i = first; i < first + count; ++i) {
+		vk::cmdDrawIndirect(cmdBuf, indirectBuffer_, i * stride, 1, stride);
+	}
+}
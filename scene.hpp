@@ -0,0 +1,180 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <vpp/device.hpp> // vpp::Device
+#include <vpp/buffer.hpp> // vpp::Buffer
+#include <vpp/vk.hpp>
+#include <nytl/vec.hpp>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+class Uploader;
+class RingBuffer;
+class MeshFile;
+
+/// Per-instance data of a triangle.
+/// Matches the instance attributes of triangle.vert.
+struct Instance {
+	nytl::Vec2f offset;
+	nytl::Vec2f scale;
+	nytl::Vec2f rotation; // cos, sin
+	float tint; // factor applied to the vertex colors
+	float _pad;
+};
+
+/// Vertices of the triangle every instance draws: vec2 position and
+/// vec3 color, matching the vertex attributes of triangle.vert.
+constexpr unsigned int triangleVertexCount = 3;
+constexpr float triangleVertices[] = {
+	// pos	  // color
+	-.8f, .5f,  0.5f, 0.8f, 0.5f,
+	.8f, .5f,   0.2f, 0.5f, 0.5f,
+	0.f, -.5f,   0.5f, 0.5f, 0.3f
+};
+
+/// Layout of the vertex buffer, the triangle pipeline is created for it.
+/// The compact formats save vertex fetch bandwidth, which competes
+/// with the multisample bandwidth.
+enum class VertexFormat {
+	float32, // vec2 position, vec3 color as floats, 20 bytes, see triangleVertices
+	half, // half float position, rgba8 color, 8 bytes
+	packed, // snorm16 position, rgba8 color, 8 bytes, see PackedVertex
+};
+
+/// Returns the name of the given format, e.g. for logging.
+const char* name(VertexFormat);
+
+/// Parses a format from its name. Returns false for an invalid name.
+bool parseVertexFormat(const char* name, VertexFormat&);
+
+/// Returns the size of a vertex in the given format.
+unsigned int vertexSize(VertexFormat);
+
+/// Knobs of the generated scene.
+/// The default settings result in the single original triangle.
+struct SceneSettings {
+	/// Number of triangles, must not be 0.
+	unsigned int count = 1;
+	/// Size of each triangle relative to the space it has when
+	/// all triangles are evenly distributed over the screen.
+	float size = 1.f;
+	/// 0: triangles evenly distributed over the screen,
+	/// 1: all triangles at the center, i.e. maximum overdraw.
+	float overlap = 0.f;
+	/// Values larger than 1 stretch the triangles into slivers with the
+	/// same area, increasing the edge length per covered pixel.
+	float edgeDensity = 1.f;
+	/// Seed for the random placement.
+	unsigned int seed = 0;
+	/// Number of indirect draws the triangles are split into.
+	/// Allows to record them on multiple threads, see RecordPool.
+	unsigned int draws = 1;
+	/// Whether to rotate the triangles every frame. The instance data
+	/// is then written into a per-frame ring buffer.
+	bool animate = false;
+	/// Binary mesh file to render instead of the generated triangles,
+	/// see MeshFile. Its chunks are streamed in while rendering.
+	std::string mesh;
+	/// Maximum number of mesh bytes uploaded per frame.
+	vk::DeviceSize streamBudget = 16u * 1024u * 1024u;
+	/// Format of the vertex buffer. By default float32 for generated
+	/// scenes and packed for meshes. Meshes are stored packed, they are
+	/// converted while streaming for other formats.
+	std::optional<VertexFormat> vertexFormat;
+};
+
+/// Returns the vertex format the scene for the given settings uses.
+inline VertexFormat vertexFormat(const SceneSettings& settings)
+{
+	auto def = settings.mesh.empty() ? VertexFormat::float32 : VertexFormat::packed;
+	return settings.vertexFormat.value_or(def);
+}
+
+/// Generates the instances for the given settings.
+std::vector<Instance> generateInstances(const SceneSettings&);
+
+/// A scene of instanced triangles.
+/// The triangles are drawn with one or multiple indirect draws, each
+/// drawing a contiguous range of instances.
+/// The static data lives in device local memory and is uploaded
+/// with the given uploader.
+/// Alternatively renders a mesh file as a single instance (that maps
+/// the quantized positions to the mesh bounds). The mesh is memory mapped
+/// and its chunks are uploaded over multiple frames, see stream. Only the
+/// completely uploaded chunks are drawn.
+class Scene {
+public:
+	/// The instances can be generated beforehand (e.g. on another thread,
+	/// see generateInstances), otherwise they are generated from settings.
+	/// Throws if the mesh file can't be opened.
+	Scene(const vpp::Device&, Uploader&, const SceneSettings& = {},
+		std::vector<Instance> instances = {});
+	~Scene();
+
+	/// Uploads the next chunks of the mesh (at most streamBudget bytes,
+	/// at least one chunk) and makes the chunks whose upload completed
+	/// visible. Submits the uploader. Does nothing without mesh.
+	/// Must be called before update and record.
+	void stream(Uploader&);
+
+	/// Returns whether not all of the mesh is visible yet.
+	bool streaming() const;
+
+	/// Writes the instance data of the given frame into the ring buffer
+	/// if the scene is animated. Time is in seconds.
+	void update(RingBuffer&, std::uint64_t frame, float time);
+
+	/// Binds the vertex and instance buffers and draws all triangles.
+	/// Must be called inside the render pass with the triangle pipeline bound.
+	void record(vk::CommandBuffer) const;
+
+	/// Like record but only records the draws [first, first + count).
+	/// Can be called from multiple threads at once.
+	void record(vk::CommandBuffer, unsigned int first, unsigned int count) const;
+
+	/// Size of the instance data, i.e. what update allocates per frame.
+	vk::DeviceSize instanceDataSize() const { return sizeof(Instance) * count_; }
+	bool animated() const { return !instances_.empty(); }
+	unsigned int count() const { return count_; }
+	VertexFormat vertexFormat() const { return vertexFormat_; }
+	std::uint64_t vertexCount() const { return vertexCount_; }
+	std::uint64_t visibleVertices() const { return visibleVertices_; }
+	unsigned int drawCount() const { return drawCount_; }
+	const vpp::Buffer& vertexBuffer() const { return vertexBuffer_; }
+	const vpp::Buffer& instanceBuffer() const { return instanceBuffer_; }
+	const vpp::Buffer& indirectBuffer() const { return indirectBuffer_; }
+
+protected:
+	struct StreamBatch {
+		std::uint64_t id; // upload batch
+		std::uint64_t end; // vertices visible once it completed
+	};
+
+	void createMesh(Uploader&, const SceneSettings&);
+
+	unsigned int count_;
+	unsigned int drawCount_;
+	VertexFormat vertexFormat_;
+	std::uint64_t vertexCount_; // per instance
+	vpp::Buffer vertexBuffer_;
+	vpp::Buffer instanceBuffer_;
+	vpp::Buffer indirectBuffer_;
+
+	std::vector<Instance> instances_; // only kept if animated
+	vk::Buffer dynamicBuffer_ {}; // ring buffer with this frames data
+	vk::DeviceSize dynamicOffset_ {};
+
+	std::unique_ptr<MeshFile> mesh_;
+	vk::DeviceSize streamBudget_ {};
+	unsigned int nextChunk_ {}; // next chunk to upload
+	std::uint64_t visibleVertices_ {}; // uploaded and drawn
+	std::deque<StreamBatch> streamBatches_; // pending, in order
+	std::vector<std::uint8_t> converted_; // chunks in vertexFormat_
+};
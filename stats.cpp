@@ -0,0 +1,78 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <stats.hpp>
+#include <algorithm> // std::nth_element, std::min_element
+
+void SampleStats::add(float value)
+{
+	// ring buffer once capacity is reached
+	if(values_.size() < capacity_) {
+		values_.push_back(value);
+	} else {
+		values_[next_] = value;
+		next_ = (next_ + 1) % capacity_;
+	}
+}
+
+void SampleStats::reset()
+{
+	values_.clear();
+	next_ = 0;
+}
+
+StatsSummary SampleStats::summary() const
+{
+	StatsSummary ret;
+	ret.count = values_.size();
+	if(values_.empty()) {
+		return ret;
+	}
+
+	auto sum = 0.0;
+	for(auto v : values_) {
+		sum += v;
+	}
+
+	ret.avg = sum / values_.size();
+	ret.min = *std::min_element(values_.begin(), values_.end());
+
+	auto sorted = values_;
+	auto percentile = [&](unsigned int p) {
+		auto it = sorted.begin() + (sorted.size() - 1) * p / 100;
+		std::nth_element(sorted.begin(), it, sorted.end());
+		return *it;
+	};
+
+	ret.p50 = percentile(50);
+	ret.p90 = percentile(90);
+	ret.p99 = percentile(99);
+
+	return ret;
+}
+
+void PhaseTimer::end(std::string name)
+{
+	using msf = std::chrono::duration<float, std::milli>;
+	auto now = Clock::now();
+	phases_.push_back({std::move(name), msf(now - last_).count(), false});
+	last_ = now;
+}
+
+void PhaseTimer::parallel(std::string name, float duration)
+{
+	phases_.push_back({std::move(name), duration, true});
+}
+
+float PhaseTimer::total() const
+{
+	auto sum = 0.f;
+	for(auto& phase : phases_) {
+		if(!phase.parallel) {
+			sum += phase.duration;
+		}
+	}
+
+	return sum;
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstddef>
+
+/// Summary of a series of measured values.
+struct StatsSummary {
+	float min {};
+	float avg {};
+	float p50 {};
+	float p90 {};
+	float p99 {};
+	std::size_t count {};
+};
+
+/// Collects the last `capacity` measured values (e.g. frame times in ms)
+/// and computes min/avg/p99 over them.
+class SampleStats {
+public:
+	SampleStats(std::size_t capacity = 1024) : capacity_(capacity) {}
+
+	void add(float value);
+	void reset();
+
+	StatsSummary summary() const;
+	std::size_t count() const { return values_.size(); }
+	const std::vector<float>& values() const { return values_; }
+
+protected:
+	std::size_t capacity_;
+	std::size_t next_ {};
+	std::vector<float> values_;
+};
+
+/// Measures the durations of consecutive phases, e.g. of the startup.
+/// Phases that ran on other threads can be added separately.
+class PhaseTimer {
+public:
+	struct Phase {
+		std::string name;
+		float duration; // in milliseconds
+		bool parallel; // ran in parallel to the consecutive phases
+	};
+
+public:
+	PhaseTimer() : last_(Clock::now()) {}
+
+	/// Ends the current phase, the next one starts now.
+	void end(std::string name);
+
+	/// Adds a phase that ran in parallel to the consecutive phases.
+	void parallel(std::string name, float duration);
+
+	/// Returns the duration of all consecutive phases in milliseconds.
+	float total() const;
+	const std::vector<Phase>& phases() const { return phases_; }
+
+protected:
+	using Clock = std::chrono::steady_clock;
+	Clock::time_point last_;
+	std::vector<Phase> phases_;
+};
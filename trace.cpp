@@ -0,0 +1,185 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <trace.hpp>
+#include <dlg/dlg.hpp> // dlg
+#include <atomic>
+#include <chrono>
+#include <cstdio> // std::snprintf
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// events per thread, further events are dropped
+constexpr auto bufferSize = 64u * 1024u;
+
+struct Event {
+	const char* name;
+	std::uint64_t begin;
+	std::uint64_t duration;
+	bool gpu;
+};
+
+// only written by the owning thread. count is published with release
+// semantics so that the written events are visible to the writer.
+// events is allocated with the first event
+struct ThreadBuffer {
+	std::uint32_t tid;
+	std::string name;
+	std::unique_ptr<Event[]> events;
+	std::atomic<std::size_t> count {};
+	std::atomic<bool> dropped {};
+};
+
+std::atomic<bool> enabled {};
+Clock::time_point start;
+
+// buffers are never destroyed so threads can keep their pointers
+std::mutex buffersMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+thread_local ThreadBuffer* threadBuffer {};
+
+ThreadBuffer& currentBuffer()
+{
+	if(!threadBuffer) {
+		auto buffer = std::make_unique<ThreadBuffer>();
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		buffer->tid = buffers.size() + 1; // 0 is traceGpuThread
+		buffer->name = "thread " + std::to_string(buffer->tid);
+		threadBuffer = buffer.get();
+		buffers.push_back(std::move(buffer));
+	}
+
+	return *threadBuffer;
+}
+
+// writes str as content of a json string
+void writeEscaped(std::ostream& out, const char* str)
+{
+	for(; *str; ++str) {
+		auto c = static_cast<unsigned char>(*str);
+		if(c == '"' || c == '\\') {
+			out << '\\' << *str;
+		} else if(c < 0x20) {
+			char buf[8];
+			std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out << buf;
+		} else {
+			out << *str;
+		}
+	}
+}
+
+} // anon namespace
+
+void traceStart()
+{
+	start = Clock::now();
+	enabled.store(true);
+	dlg_info("trace: started");
+}
+
+bool traceEnabled()
+{
+	return enabled.load(std::memory_order_relaxed);
+}
+
+std::uint64_t traceNow()
+{
+	if(!traceEnabled()) {
+		return 0u;
+	}
+
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		Clock::now() - start).count();
+}
+
+void traceSpan(const char* name, std::uint64_t begin, std::uint64_t duration,
+	bool gpu)
+{
+	if(!traceEnabled()) {
+		return;
+	}
+
+	auto& buffer = currentBuffer();
+	auto count = buffer.count.load(std::memory_order_relaxed);
+	if(count >= bufferSize) {
+		buffer.dropped.store(true, std::memory_order_relaxed);
+		return;
+	}
+
+	if(!buffer.events) {
+		buffer.events = std::make_unique<Event[]>(bufferSize);
+	}
+
+	buffer.events[count] = {name, begin, duration, gpu};
+	buffer.count.store(count + 1, std::memory_order_release);
+}
+
+void traceThreadName(std::string name)
+{
+	// might be called before tracing is started
+	auto& buffer = currentBuffer();
+	std::lock_guard<std::mutex> lock(buffersMutex);
+	buffer.name = std::move(name);
+}
+
+bool traceWrite(const std::string& path)
+{
+	std::ofstream out(path);
+	if(!out.is_open()) {
+		dlg_error("trace: could not open '{}'", path);
+		return false;
+	}
+
+	// timestamps and durations are in microseconds
+	auto first = true;
+	auto sep = [&]() -> std::ostream& {
+		out << (first ? "\n" : ",\n");
+		first = false;
+		return out;
+	};
+
+	std::lock_guard<std::mutex> lock(buffersMutex);
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	sep() << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+		<< "\"tid\": " << traceGpuThread << ", \"args\": {\"name\": \"gpu\"}}";
+
+	auto total = std::size_t(0);
+	for(auto& buffer : buffers) {
+		sep() << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+			<< "\"tid\": " << buffer->tid << ", \"args\": {\"name\": \"";
+		writeEscaped(out, buffer->name.c_str());
+		out << "\"}}";
+
+		auto count = buffer->count.load(std::memory_order_acquire);
+		for(auto i = 0u; i < count; ++i) {
+			auto& ev = buffer->events[i];
+			auto tid = ev.gpu ? traceGpuThread : buffer->tid;
+			sep() << "{\"name\": \"";
+			writeEscaped(out, ev.name);
+			out << "\", \"cat\": \""
+				<< (ev.gpu ? "gpu" : "cpu") << "\", \"ph\": \"X\", "
+				<< "\"ts\": " << ev.begin / 1000.0 << ", "
+				<< "\"dur\": " << ev.duration / 1000.0 << ", "
+				<< "\"pid\": 1, \"tid\": " << tid << "}";
+		}
+
+		if(buffer->dropped.load()) {
+			dlg_warn("trace: buffer of '{}' ran full, events were dropped",
+				buffer->name);
+		}
+
+		total += count;
+	}
+
+	out << "\n]}\n";
+	dlg_info("trace: wrote {} events to '{}'", total, path);
+	return bool(out);
+}
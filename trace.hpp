@@ -0,0 +1,61 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Minimal recorder for chrome trace events (chrome://tracing, perfetto).
+// Every thread appends to its own fixed size buffer, without locking.
+// The markers below only record anything if the project was built with
+// ENABLE_TRACE (meson option 'trace') and tracing was started, otherwise
+// they compile to nothing.
+
+/// Pseudo thread id the gpu spans are written with.
+constexpr std::uint32_t traceGpuThread = 0u;
+
+/// Starts recording events. Before this, all events are ignored.
+void traceStart();
+bool traceEnabled();
+
+/// Returns the time since traceStart in nanoseconds.
+std::uint64_t traceNow();
+
+/// Records a span (complete event) on the calling threads buffer.
+/// name must be a string literal (or otherwise outlive the trace).
+/// If gpu is true, the span is shown on the traceGpuThread instead.
+void traceSpan(const char* name, std::uint64_t begin, std::uint64_t duration,
+	bool gpu = false);
+
+/// Sets the name the calling thread is shown with.
+/// Can already be called before traceStart.
+void traceThreadName(std::string name);
+
+/// Writes all recorded events as chrome trace json to the given file.
+/// Events that other threads record concurrently may be missing.
+/// Returns false if the file could not be written.
+bool traceWrite(const std::string& path);
+
+/// Records a span from construction to destruction.
+class TraceScope {
+public:
+	TraceScope(const char* name) : name_(name), begin_(traceNow()) {}
+	~TraceScope() { traceSpan(name_, begin_, traceNow() - begin_); }
+
+protected:
+	const char* name_;
+	std::uint64_t begin_;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef ENABLE_TRACE
+	#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name)
+	#define TRACE_THREAD_NAME(name) traceThreadName(name)
+#else
+	#define TRACE_SCOPE(name)
+	#define TRACE_THREAD_NAME(name)
+#endif
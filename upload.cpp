@@ -0,0 +1,193 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <upload.hpp>
+#include <dlg/dlg.hpp> // dlg
+#include <cstring> // std::memcpy
+
+// Uploader
+Uploader::Uploader(const vpp::Device& dev, const vpp::Queue& transfer,
+	const vpp::Queue& graphics) : device_(&dev), queue_(&transfer)
+{
+	families_.push_back(graphics.family());
+	if(transfer.family() != graphics.family()) {
+		families_.push_back(transfer.family());
+		dlg_info("Uploader: using dedicated transfer queue family {}",
+			transfer.family());
+	}
+}
+
+Uploader::~Uploader()
+{
+	wait();
+}
+
+vpp::Buffer Uploader::createBuffer(vk::BufferUsageFlags usage,
+	vk::DeviceSize size)
+{
+	vk::BufferCreateInfo info;
+	info.size = size;
+	info.usage = usage | vk::BufferUsageBits::transferDst;
+	if(families_.size() > 1) {
+		info.sharingMode = vk::SharingMode::concurrent;
+		info.queueFamilyIndexCount = families_.size();
+		info.pQueueFamilyIndices = families_.data();
+	}
+
+	auto mem = device().memoryTypeBits(vk::MemoryPropertyBits::deviceLocal);
+	return {device().devMemAllocator(), info, mem};
+}
+
+vpp::Buffer Uploader::createBuffer(vk::BufferUsageFlags usage,
+	const void* data, vk::DeviceSize size)
+{
+	auto buf = createBuffer(usage, size);
+	write(buf, 0, data, size);
+	return buf;
+}
+
+void Uploader::write(vk::Buffer dst, vk::DeviceSize offset, const void* data,
+	vk::DeviceSize size)
+{
+	auto& batch = current();
+
+	vk::BufferCreateInfo info;
+	info.size = size;
+	info.usage = vk::BufferUsageBits::transferSrc;
+	auto mem = device().memoryTypeBits(vk::MemoryPropertyBits::hostVisible |
+		vk::MemoryPropertyBits::hostCoherent);
+	batch.staging.emplace_back(device().devMemAllocator(), info, mem);
+
+	auto& staging = batch.staging.back();
+	{
+		auto map = staging.memoryMap(0, size);
+		std::memcpy(map.ptr(), data, size);
+	}
+
+	vk::BufferCopy region {0u, offset, size};
+	vk::cmdCopyBuffer(batch.commandBuffer, staging, dst, {region});
+}
+
+Uploader::Batch& Uploader::current()
+{
+	if(!recording_) {
+		recording_ = std::make_unique<Batch>();
+		recording_->commandBuffer = device().commandAllocator().get(queue_->family());
+		recording_->fence = {device()};
+		vk::beginCommandBuffer(recording_->commandBuffer,
+			{vk::CommandBufferUsageBits::oneTimeSubmit});
+	}
+
+	return *recording_;
+}
+
+std::uint64_t Uploader::submit()
+{
+	if(!recording_) {
+		return 0u;
+	}
+
+	auto& batch = *recording_;
+	vk::endCommandBuffer(batch.commandBuffer);
+
+	vk::CommandBuffer cmdBuf = batch.commandBuffer;
+	vk::SubmitInfo submitInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &cmdBuf;
+	vk::queueSubmit(queue_->vkHandle(), {submitInfo}, batch.fence);
+
+	batch.id = nextId_++;
+	pending_.push_back(std::move(batch));
+	recording_.reset();
+	return pending_.back().id;
+}
+
+void Uploader::collect()
+{
+	while(!pending_.empty() && vk::getFenceStatus(device(),
+			pending_.front().fence) == vk::Result::success) {
+		pending_.pop_front();
+	}
+}
+
+bool Uploader::done(std::uint64_t batch)
+{
+	collect();
+	return pending_.empty() || pending_.front().id > batch;
+}
+
+void Uploader::wait()
+{
+	submit();
+	for(auto& batch : pending_) {
+		vk::waitForFences(device(), {batch.fence}, true, UINT64_MAX);
+	}
+
+	pending_.clear();
+}
+
+// RingBuffer
+RingBuffer::RingBuffer(const vpp::Device& dev, vk::BufferUsageFlags usage,
+	vk::DeviceSize size) : size_(size)
+{
+	vk::BufferCreateInfo info;
+	info.size = size;
+	info.usage = usage;
+
+	// prefer memory that is device local as well (e.g. resizable bar)
+	auto hostBits = vk::MemoryPropertyBits::hostVisible |
+		vk::MemoryPropertyBits::hostCoherent;
+	auto mem = dev.memoryTypeBits(hostBits | vk::MemoryPropertyBits::deviceLocal);
+	if(!mem) {
+		mem = dev.memoryTypeBits(hostBits);
+	}
+
+	buffer_ = {dev.devMemAllocator(), info, mem};
+	map_ = buffer_.memoryMap(0, size);
+}
+
+RingBuffer::Allocation RingBuffer::allocate(vk::DeviceSize size,
+	std::uint64_t frame, vk::DeviceSize align)
+{
+	auto alignUp = [&](vk::DeviceSize off) {
+		return (off + align - 1) / align * align;
+	};
+
+	if(segments_.empty()) {
+		head_ = tail_ = 0u;
+	} else if(head_ == tail_) {
+		return {0u, nullptr}; // completely full
+	}
+
+	// free space is [head_, size_) + [0, tail_) or [head_, tail_)
+	auto offset = alignUp(head_);
+	if(head_ >= tail_) {
+		if(offset + size > size_) {
+			if(size > tail_) {
+				return {0u, nullptr};
+			}
+
+			offset = 0u; // wrap around, wasting the rest
+		}
+	} else if(offset + size > tail_) {
+		return {0u, nullptr};
+	}
+
+	head_ = offset + size;
+	if(!segments_.empty() && segments_.back().frame == frame) {
+		segments_.back().end = head_;
+	} else {
+		segments_.push_back({frame, head_});
+	}
+
+	return {offset, static_cast<char*>(map_.ptr()) + offset};
+}
+
+void RingBuffer::reclaim(std::uint64_t completedFrames)
+{
+	while(!segments_.empty() && segments_.front().frame < completedFrames) {
+		tail_ = segments_.front().end;
+		segments_.pop_front();
+	}
+}
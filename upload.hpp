@@ -0,0 +1,122 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <vpp/device.hpp> // vpp::Device
+#include <vpp/queue.hpp> // vpp::Queue
+#include <vpp/buffer.hpp> // vpp::Buffer
+#include <vpp/memoryMap.hpp> // vpp::MemoryMapView
+#include <vpp/commandBuffer.hpp> // vpp::CommandBuffer
+#include <vpp/handles.hpp>
+#include <vpp/vk.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+/// Uploads data into device local buffers through host visible
+/// staging buffers. Should be given a dedicated transfer queue if the
+/// device has one, the copies then run asynchronously to rendering.
+/// Uploads are batched: all writes until the next submit are recorded
+/// into one command buffer.
+class Uploader {
+public:
+	/// The graphics queue is the queue the uploaded buffers are used on.
+	/// Buffers created by the uploader are shared concurrently between
+	/// both queue families if they differ.
+	Uploader(const vpp::Device&, const vpp::Queue& transfer,
+		const vpp::Queue& graphics);
+	~Uploader();
+
+	/// Creates a device local buffer with the given usage (transferDst is
+	/// added automatically) and records a write of the given data into it.
+	/// The buffer must not be used before the upload has completed.
+	vpp::Buffer createBuffer(vk::BufferUsageFlags usage, const void* data,
+		vk::DeviceSize size);
+
+	/// Creates a device local buffer like createBuffer, without content.
+	vpp::Buffer createBuffer(vk::BufferUsageFlags usage, vk::DeviceSize size);
+
+	/// Records a write of the given data into dst at the given offset.
+	/// dst must have been created by this uploader.
+	void write(vk::Buffer dst, vk::DeviceSize offset, const void* data,
+		vk::DeviceSize size);
+
+	/// Submits all recorded writes. Does not wait for their completion.
+	/// Returns the id of the submitted batch (0 if there was nothing to submit).
+	std::uint64_t submit();
+
+	/// Returns whether the batch with the given id has completed.
+	/// Frees the staging memory of completed batches.
+	bool done(std::uint64_t batch);
+
+	/// Submits pending writes and waits for all batches to complete.
+	void wait();
+
+	const vpp::Queue& queue() const { return *queue_; }
+	bool dedicated() const { return families_.size() > 1; }
+	const vpp::Device& device() const { return *device_; }
+
+protected:
+	struct Batch {
+		vpp::CommandBuffer commandBuffer;
+		vpp::Fence fence;
+		std::vector<vpp::Buffer> staging;
+		std::uint64_t id {};
+	};
+
+	Batch& current(); // batch recording writes, begins it if needed
+	void collect(); // frees completed batches
+
+protected:
+	const vpp::Device* device_;
+	const vpp::Queue* queue_;
+	std::vector<std::uint32_t> families_;
+
+	std::unique_ptr<Batch> recording_;
+	std::deque<Batch> pending_; // submitted, ordered by id
+	std::uint64_t nextId_ {1};
+};
+
+/// Persistently mapped, host visible ring buffer for data that changes
+/// every frame. Every allocation is tagged with the number of the frame
+/// that uses it and reclaimed once that frame has completed.
+class RingBuffer {
+public:
+	struct Allocation {
+		vk::DeviceSize offset;
+		void* data;
+	};
+
+public:
+	RingBuffer(const vpp::Device&, vk::BufferUsageFlags, vk::DeviceSize size);
+
+	/// Allocates size bytes (aligned to align) for the given frame.
+	/// Returns an allocation with a nullptr data if the ring is full,
+	/// i.e. too many frames are pending.
+	Allocation allocate(vk::DeviceSize size, std::uint64_t frame,
+		vk::DeviceSize align = 16u);
+
+	/// Reclaims all allocations of frames with a number lower than
+	/// the given number of completed frames.
+	void reclaim(std::uint64_t completedFrames);
+
+	const vpp::Buffer& buffer() const { return buffer_; }
+	vk::DeviceSize size() const { return size_; }
+
+protected:
+	struct Segment {
+		std::uint64_t frame;
+		vk::DeviceSize end; // end of the frames allocations
+	};
+
+	vpp::Buffer buffer_;
+	vpp::MemoryMapView map_;
+	vk::DeviceSize size_;
+	vk::DeviceSize head_ {}; // next free byte
+	vk::DeviceSize tail_ {}; // first used byte
+	std::deque<Segment> segments_; // ordered by frame
+};
@@ -16,6 +16,8 @@
 #include <ny/windowContext.hpp> // ny::WindowContext
 #include <ny/windowSettings.hpp> // ny::WindowEdge
 #include <nytl/vecOps.hpp> // operator<<
+#include <algorithm> // std::find
+#include <iterator> // std::begin, std::end
 
 // TODO: to make this work for android, implement the surfaceCreated/surfaceDestroyed
 // methods
@@ -93,25 +95,72 @@ void MainWindowListener::key(const ny::KeyEvent& keyEvent)
 			wc().customDecorated(!wc().customDecorated());
 		}
 	} else if(keyEvent.pressed) {
-		if(keycode == ny::Keycode::k1) {
+		// the sample count keys leave post-process anti aliasing
+		auto& renderer = engine_.renderer();
+		auto sampleKey = keycode == ny::Keycode::k1 || keycode == ny::Keycode::k2 ||
+			keycode == ny::Keycode::k4 || keycode == ny::Keycode::k8;
+		if(sampleKey && renderer.resolve() == ResolveMode::fxaa) {
+			renderer.resolve(ResolveMode::renderPass);
+		}
+
+		if(keycode == ny::Keycode::k0) {
+			dlg_info("Using fxaa instead of multisampling");
+			renderer.samples(vk::SampleCountBits::e1);
+			renderer.resolve(ResolveMode::fxaa);
+		} else if(keycode == ny::Keycode::k1) {
 			dlg_info("Using no multisampling");
-			engine_.renderer().samples(vk::SampleCountBits::e1);
+			renderer.samples(vk::SampleCountBits::e1);
 		} else if(keycode == ny::Keycode::k2) {
 			dlg_info("Using 2 multisamples");
-			engine_.renderer().samples(vk::SampleCountBits::e2);
+			renderer.samples(vk::SampleCountBits::e2);
 		} else if(keycode == ny::Keycode::k4) {
 			dlg_info("Using 4 multisamples");
-			engine_.renderer().samples(vk::SampleCountBits::e4);
+			renderer.samples(vk::SampleCountBits::e4);
 		} else if(keycode == ny::Keycode::k8) {
 			dlg_info("Using 8 multisamples");
-			engine_.renderer().samples(vk::SampleCountBits::e8);
+			renderer.samples(vk::SampleCountBits::e8);
+		} else if(keycode == ny::Keycode::r) {
+			engine_.logMemoryReport();
+		} else if(keycode == ny::Keycode::c) {
+			// cycles through the msaa resolve modes, not fxaa
+			auto next = (static_cast<unsigned int>(renderer.resolve()) + 1) % 4;
+			auto mode = static_cast<ResolveMode>(next);
+			dlg_info("Using {} resolve", name(mode));
+			renderer.resolve(mode);
+		} else if(keycode == ny::Keycode::p) {
+			// cycles through the present modes, keeps the image count
+			const vk::PresentModeKHR modes[] = {
+				vk::PresentModeKHR::fifo,
+				vk::PresentModeKHR::mailbox,
+				vk::PresentModeKHR::immediate,
+				vk::PresentModeKHR::fifoRelaxed,
+			};
+
+			auto it = std::find(std::begin(modes), std::end(modes),
+				renderer.presentMode());
+			auto next = (it == std::end(modes) || ++it == std::end(modes)) ?
+				modes[0] : *it;
+			dlg_info("Requesting {} present mode", name(next));
+			renderer.presentMode(next, engine_.settings().imageCount);
+		} else if(keycode == ny::Keycode::minus ||
+				keycode == ny::Keycode::equals) {
+			auto step = (keycode == ny::Keycode::minus) ? -0.1f : 0.1f;
+			renderer.renderScale(renderer.renderScale() + step);
+			dlg_info("Using render scale {}", renderer.renderScale());
 		}
 	}
 }
 void MainWindowListener::state(const ny::StateEvent& stateEvent)
 {
-	if(stateEvent.state != toplevelState_)
+	if(stateEvent.state != toplevelState_) {
 		toplevelState_ = stateEvent.state;
+		engine_.renderer().redraw();
+	}
+}
+void MainWindowListener::draw(const ny::DrawEvent&)
+{
+	// the window system lost (parts of) the content
+	engine_.renderer().redraw();
 }
 void MainWindowListener::close(const ny::CloseEvent&)
 {
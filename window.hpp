@@ -20,6 +20,7 @@ public:
 	void state(const ny::StateEvent&) override;
 	void close(const ny::CloseEvent&) override;
 	void resize(const ny::SizeEvent&) override;
+	void draw(const ny::DrawEvent&) override;
 
 protected:
 	ny::AppContext& ac() const;